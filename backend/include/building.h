@@ -54,11 +54,18 @@ inline void get_os_radius_url(char *url_buff, size_t url_buff_sz, float x,
            config("OS_PROJECT_API_KEY").c_str(), x, y, radius, offset);
 }
 
-std::vector<Building> fetch_buildings(CURL *handle, float x, float y,
-                                      int radius);
+/*
+ * Every address `radius` meters around (`x`,`y`) grouped
+ * into `Building`s. Pages after the first are fetched
+ * concurrently on `fetcher`. `complete` is set false if
+ * a page couldn't be fetched or parsed, so addresses
+ * may be missing.
+ */
+std::vector<Building> fetch_buildings(MultiFetcher &fetcher, float x, float y,
+                                      int radius, bool &complete);
 
 inline std::string get_location_key(float x, float y) {
-  return std::to_string(static_cast<int>(x * 100)) +
+  return std::to_string(static_cast<int>(x * 100)) + "," +
          std::to_string(static_cast<int>(y * 100));
 }
 
@@ -66,7 +73,7 @@ void combine_buildings(Building &x, Building &y);
 
 std::vector<Building> cluster_buildings(std::vector<Building> &buildings);
 
-inline ValuationDB::QueryParam get_query_param(const Building &b) {
+inline ValuationEngine::QueryParam get_query_param(const Building &b) {
   return {b.name.c_str(), b.street.c_str(), b.postcode.c_str(),
           b.tob == TypeOfBuilding::RESIDENTIAL};
 }
@@ -89,4 +96,7 @@ NLOHMANN_JSON_SERIALIZE_ENUM(TypeOfBuilding, {{MIXED, "MIXED"},
 NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Building, name, street, town, postcode,
                                    location, subunits, valuations, tob,
                                    plan_apps)
+void write_json(JsonWriter &writer, const SubUnit &unit);
+void write_json(JsonWriter &writer, TypeOfBuilding tob);
+void write_json(JsonWriter &writer, const Building &building);
 #endif
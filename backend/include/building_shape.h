@@ -1,5 +1,7 @@
 #ifndef GUARD_BUILDING_SHAPE
 #define GUARD_BUILDING_SHAPE
+#include "json_writer.h"
+#include "lru_cache.h"
 #include "sqlitedb.h"
 #include "util.h"
 #include "vector_tile.pb.h"
@@ -7,6 +9,7 @@
 #include <cfloat>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <curl/curl.h>
@@ -17,6 +20,7 @@
 #include <iostream>
 #include <iterator>
 #include <limits>
+#include <memory>
 #include <string>
 #include <unordered_set>
 #include <utility>
@@ -73,8 +77,18 @@ struct PairEq {
 
 typedef std::pair<int, int> GridPos;
 typedef std::unordered_set<GridPos, PairHash, PairEq> GridPosSet;
-typedef std::unordered_map<std::pair<Point, Point>, int, PairHash, PairEq>
-    EdgeToPenaltyMap;
+
+// Inclusive cell space bounding box
+struct BBox {
+  int min_x;
+  int min_y;
+  int max_x;
+  int max_y;
+
+  inline bool contains(const Point &p) const {
+    return min_x <= p.x && p.x <= max_x && min_y <= p.y && p.y <= max_y;
+  }
+};
 
 /*
  * class to convert between the BNG and
@@ -121,18 +135,75 @@ public:
 
   std::vector<GridPos> missing_tiles(const std::vector<GridPos> &positions);
 
-  void insert(const GridPos &pos, std::string &data);
+  bool insert(const GridPos &pos, std::string &data);
+
+  /*
+   * Inserts all `datas` in a single transaction,
+   * rolled back if any of it fails
+   */
+  bool insert(const std::vector<GridPos> &positions,
+              std::vector<std::string> &datas);
 
   vector_tile::Tile tile(const GridPos &pos);
 
-private:
-  int make_missing_shapes_select(const std::vector<GridPos> &positions);
+  // false if no combined tile is stored under `key`
+  bool combined_tile(const std::string &key, vector_tile::Tile &res);
 
-  int make_insert(const GridPos &pos);
+  // stores `tile`, combined from the tiles at `positions`
+  void insert_combined_tile(const std::string &key,
+                            const std::vector<GridPos> &positions,
+                            const vector_tile::Tile &tile);
 
-  int make_tiles_grid_select(const GridPos &pos);
+private:
+  // ids of the prepared statements
+  enum Statement {
+    MISSING_TILES_SELECT,
+    TILE_INSERT,
+    TILE_SELECT,
+    COMBINED_TILE_SELECT,
+    COMBINED_TILE_INSERT,
+    COMBINED_TILE_MEMBERS_INSERT,
+    COMBINED_TILES_DELETE,
+    COMBINED_TILE_MEMBERS_DELETE
+  };
+
+  // drops every combined tile made from the tile at `pos`
+  void remove_combined_tiles(const GridPos &pos);
 };
 
+typedef LRUCache<GridPos, vector_tile::Tile, PairHash, PairEq> TileCache;
+
+/*
+ * Decoded tiles shared by every worker, bounded
+ * by the TILE_CACHE_BYTES config key.
+ */
+TileCache &tile_cache();
+
+/*
+ * Combined tiles depend only on their centre tile
+ * and the tiles combined around it
+ */
+std::string combined_tile_key(std::vector<GridPos> positions, int centre_row,
+                              int centre_col);
+
+/*
+ * Every position in the smallest square around the
+ * centre tile at (`centre_row`,`centre_col`) that holds
+ * all of `positions`, in row major order. Combining the
+ * whole square means there are only a few possible
+ * combined tiles per centre, rather than one per subset
+ * of the tiles around it.
+ */
+std::vector<GridPos> get_neighbourhood(const std::vector<GridPos> &positions,
+                                       int centre_row, int centre_col);
+
+/*
+ * Tile at `pos`, decoded from `db` only
+ * if it isn't already in `tile_cache()`.
+ */
+std::shared_ptr<const vector_tile::Tile> get_tile(BuildingShapesDB &db,
+                                                  const GridPos &pos);
+
 std::string value_to_string(const vector_tile::FullTile_Value &val);
 
 inline bool is_building_shape_valid(const vector_tile::Tile_BuildingShape &b) {
@@ -154,6 +225,16 @@ bool decode_feature(const vector_tile::FullTile_Feature &feat,
 
 vector_tile::Tile parse_tile(std::string &tile_data);
 
+/*
+ * Records which of `tile`s shapes are interior: clear
+ * of the tile border and the only shape with their
+ * osid. Those can't be parts of a building split
+ * across tiles so combining tiles copies them as they
+ * are, only matching up the remaining border shapes
+ * by osid.
+ */
+void set_interior_shapes(vector_tile::Tile &tile);
+
 inline int get_tiles_api_url(char url_buff[], size_t buff_sz, int grid_row,
                              int grid_col) {
   return snprintf(url_buff, buff_sz, "%s/%d/%d?key=%s",
@@ -161,68 +242,247 @@ inline int get_tiles_api_url(char url_buff[], size_t buff_sz, int grid_row,
                   config("OS_PROJECT_API_KEY").c_str());
 }
 
-void fetch_missing_tiles(CURL *handle, char url_buff[], size_t buff_sz,
-                         BuildingShapesDB &db, std::vector<GridPos> &missing);
+/*
+ * Download, parse and store every tile in `missing`
+ * concurrently. Tiles another request is already
+ * downloading aren't fetched again, instead this
+ * waits until that request has stored them.
+ */
+void fetch_missing_tiles(MultiFetcher &fetcher, BuildingShapesDB &db,
+                         const std::vector<GridPos> &missing);
+
+/*
+ * Fetch any tiles in `positions` that aren't already
+ * stored in `db`. False if some still aren't after.
+ */
+bool fetch_tiles(MultiFetcher &fetcher, BuildingShapesDB &db,
+                 const std::vector<GridPos> &positions);
+
+/*
+ * Grid positions of every tile that a search `radius`
+ * meters around `centre` can land in, widened to the
+ * neighbourhood (see `get_neighbourhood`) that results
+ * are clustered against so it can all be fetched early.
+ */
+std::vector<GridPos> get_search_grid_positions(const FPoint &centre,
+                                               int radius);
 
 float gradient(int x1, int y1, int x2, int y2);
 
 Point midpoint(int x1, int y1, int x2, int y2);
 
+inline int floor_mod(int x, int y) { return x - floor(x / (y * 1.0f)) * y; }
+
+/*
+ * Flat, structure of arrays copy of building shapes
+ * that the geometry code runs on, converted once per
+ * tile instead of walking protobuf messages.
+ * A shape is made of rings: runs of edges where each
+ * edge starts where the last one ended. A ring stores
+ * each of its vertices once and every consecutive pair
+ * of vertices is an edge, in the same order as the
+ * shape's edges. Decoded polygons are closed rings,
+ * combined shapes can be broken into several open ones.
+ */
+struct ShapeStore {
+  std::vector<int32_t> xs;
+  std::vector<int32_t> ys;
+  // penalty (see `set_penalties`) of
+  // the edge starting at each vertex
+  std::vector<int8_t> penalties;
+  // ring r is vertices [ring_offsets[r], ring_offsets[r+1])
+  std::vector<uint32_t> ring_offsets;
+  // shape s is rings [shape_rings[s], shape_rings[s+1])
+  std::vector<uint32_t> shape_rings;
+  std::vector<BBox> bboxes;
+  std::vector<Point> centres;
+
+  ShapeStore();
+
+  ShapeStore(const vector_tile::Tile &tile);
+
+  inline int size() const { return bboxes.size(); }
+
+  inline int edge_count(int shape) const {
+    return ring_offsets[shape_rings[shape + 1]] -
+           ring_offsets[shape_rings[shape]] -
+           (shape_rings[shape + 1] - shape_rings[shape]);
+  }
+
+  // approximate heap bytes used
+  size_t bytes() const;
+
+  // make room for all of `tile`s shapes
+  void reserve(const vector_tile::Tile &tile);
+
+  /*
+   * Add `shape` moved by (`x_shift`, `y_shift`),
+   * using its stored edge penalties if it has them
+   */
+  void add_shape(const vector_tile::Tile_BuildingShape &shape,
+                 int x_shift = 0, int y_shift = 0);
+
+  /*
+   * Replaces `res` with the index of the first
+   * vertex of each of `shape`s edges, in edge order.
+   */
+  void edge_starts(int shape, std::vector<int> &res) const;
+
+  // copies edges, penalties and centre into `res`
+  void to_building_shape(int shape,
+                         vector_tile::Tile_BuildingShape &res) const;
+
+private:
+  void add_vertex(int x, int y, BBox &bbox);
+
+  void set_penalties(int shape);
+};
+
+/*
+ * Works out and stores the penalty of each of `shape`s
+ * edges. Penalties depend only on the shape so this is
+ * done once as tiles are stored, saving every request
+ * that loads them from doing it again.
+ */
+void set_edge_penalties(vector_tile::Tile_BuildingShape &shape);
+
 /*
  * Modified version of the ray casting algorith from:
  * https://en.wikipedia.org/wiki/Point_in_polygon#Ray_casting_algorithm
  * which projects two vertical rays, above and below, to
  * determine if a point is inside, outside or on the edge of a shape.
  */
-EnclosureType get_enclosure_type(const Point &p,
-                                 const vector_tile::Tile_BuildingShape &shape,
-                                 const EdgeToPenaltyMap &pen_mp);
+EnclosureType get_enclosure_type(const Point &p, const ShapeStore &store,
+                                 int shape);
 
-inline int floor_mod(int x, int y) { return x - floor(x / (y * 1.0f)) * y; }
+/*
+ * Uniform grid over the bounding boxes of the shapes
+ * in a store. Each bucket lists the shapes whose bbox
+ * overlaps it so a point only has to be ray cast
+ * against the few shapes around it.
+ * A point can only be INSIDE a shape if it's within
+ * its bbox so this never misses a containing shape.
+ */
+class ShapeIndex {
+public:
+  ShapeIndex(const std::vector<BBox> &bboxes);
 
-EdgeToPenaltyMap
-edge_to_penalty_map(const vector_tile::Tile_BuildingShape &shape);
+  /*
+   * Replaces `res` with the indexes of shapes
+   * whose bbox contains `p`, in ascending order.
+   */
+  void query(const Point &p, std::vector<int> &res) const;
 
-std::vector<EdgeToPenaltyMap>
-edge_to_penalty_maps(const vector_tile::Tile &tile);
+  // approximate heap bytes used
+  size_t bytes() const;
+
+private:
+  const std::vector<BBox> &bboxes;
+  BBox bounds;
+  int bucket_size;
+  int ncols;
+  int nrows;
+  // shapes in bucket i are
+  // bucket_shapes[bucket_offsets[i]:bucket_offsets[i+1]]
+  std::vector<int> bucket_offsets;
+  std::vector<int> bucket_shapes;
+};
 
 /*
  * Algorithm to prune any edges that
- * have midpoints inside of any of the given
- * `shapes`. These edges can't be boundry
+ * have midpoints inside of any of the other
+ * given `shapes`. These edges can't be boundry
  * edges by definition and don't belong in
  * the combined result shape `res`.
  */
-void combine_building_shapes(
-    const std::vector<const vector_tile::Tile_BuildingShape *> &shapes,
-    vector_tile::Tile_BuildingShape &res);
+void combine_building_shapes(const ShapeStore &store,
+                             const std::vector<int> &shapes,
+                             vector_tile::Tile_BuildingShape &res);
+
+/*
+ * A combined tile, the positions it was made from and
+ * the store and index lookups against it run on. Those
+ * are built once by `index_shapes` and shared by every
+ * request using the tile. `index` refers to `store` so
+ * this can't be copied or moved.
+ */
+struct CombinedTile {
+  vector_tile::Tile tile;
+  std::vector<GridPos> positions;
+  ShapeStore store;
+  std::unique_ptr<ShapeIndex> index;
+  // false if some of its tiles couldn't be fetched,
+  // those are left out and it isn't cached
+  bool complete;
+
+  CombinedTile() : complete(true) {}
+  CombinedTile(const CombinedTile &other) = delete;
+  CombinedTile(CombinedTile &&other) = delete;
+  CombinedTile &operator=(const CombinedTile &other) = delete;
+  CombinedTile &operator=(CombinedTile &&other) = delete;
+
+  // builds `store` and `index` from `tile`
+  void index_shapes();
+
+  // approximate bytes used, what it costs in the cache
+  size_t bytes() const;
+};
+
+typedef LRUCache<std::string, CombinedTile> CombinedTileCache;
 
 /*
- * Get a single tile representing all of the
- * individual tiles in `positions`. Cell coordinates
+ * Combined tiles shared by every worker, bounded by
+ * the COMBINED_TILE_CACHE_BYTES config key. Backed by
+ * the combined_tiles table so they outlive the server.
+ */
+CombinedTileCache &combined_tile_cache();
+
+/*
+ * Get a single tile representing all of the individual
+ * tiles in the neighbourhood (see `get_neighbourhood`)
+ * of `positions`, indexed for lookups. Cell coordinates
  * in the result are relative to the centre tile at
- * (`centre_row`,`centre_col`).
+ * (`centre_row`,`centre_col`). Tiles missing from `db`
+ * are fetched with `fetcher` and stored first.
+ * Results are cached in memory and in `db`.
  */
-vector_tile::Tile get_combined_tile(CURL *handle,
-                                    const std::vector<GridPos> &positions,
-                                    int centre_row, int centre_col);
+std::shared_ptr<const CombinedTile>
+get_combined_tile(MultiFetcher &fetcher, BuildingShapesDB &db,
+                  const std::vector<GridPos> &positions, int centre_row,
+                  int centre_col);
 
 /*
  * Translate `Point p` to the centre of
  * a building shape if it's found to be
  * within one.
  */
-void translate_point_to_building_centre(Point &p, const vector_tile::Tile &tile,
-                                        std::vector<EdgeToPenaltyMap> &pen_mps);
+void translate_point_to_building_centre(Point &p, const ShapeStore &store,
+                                        const ShapeIndex &index);
+
+/*
+ * Batched form of the lookup above: replaces `res`
+ * with the index of the first shape each of `points`
+ * is inside, or -1. Points are grouped by candidate
+ * shape so a large shape's edges are swept once, rather
+ * than once per point. Small shapes, or those with few
+ * points, are checked per point as sweeping them is slower.
+ */
+void get_enclosing_shapes(const std::vector<Point> &points,
+                          const ShapeStore &store, const ShapeIndex &index,
+                          std::vector<int> &res);
 
 /*
  * `centre` are the central bng coordinates
  * used in a OS radius call to obtain the
- * `bng_coords` to be translated.
+ * `bng_coords` to be translated. False if
+ * some tiles couldn't be fetched, so points
+ * in them weren't translated.
  */
-void translate_points_to_building_centres(CURL *handle,
+bool translate_points_to_building_centres(MultiFetcher &fetcher,
+                                          BuildingShapesDB &db,
                                           std::vector<FPoint *> &bng_coords,
                                           FPoint centre);
 
 NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(FPoint, x, y)
+void write_json(JsonWriter &writer, const FPoint &p);
 #endif
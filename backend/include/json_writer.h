@@ -0,0 +1,118 @@
+#ifndef GUARD_JSON_WRITER_H
+#define GUARD_JSON_WRITER_H
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+ * Writes JSON straight into a buffer that's kept
+ * between writes, for responses too big to build
+ * as nlohmann::json first. The output is the same
+ * as nlohmann's dump(), which sorts object keys, so
+ * keys have to be written in sorted order.
+ */
+class JsonWriter {
+public:
+  JsonWriter() : need_comma(false) {}
+
+  const char *data() const { return buff.data(); }
+
+  size_t size() const { return buff.size(); }
+
+  // Empties the buffer, keeping where in the document it's up to
+  void clear() { buff.clear(); }
+
+  void start_object() {
+    separate();
+    buff += '{';
+    need_comma = false;
+  }
+
+  void end_object() {
+    buff += '}';
+    need_comma = true;
+  }
+
+  void start_array() {
+    separate();
+    buff += '[';
+    need_comma = false;
+  }
+
+  void end_array() {
+    buff += ']';
+    need_comma = true;
+  }
+
+  void key(const char *name) {
+    separate();
+    write_string(name);
+    buff += ':';
+    need_comma = false;
+  }
+
+  void value(const std::string &val) {
+    separate();
+    write_string(val.c_str(), val.size());
+    need_comma = true;
+  }
+
+  void value(const char *val) {
+    separate();
+    write_string(val);
+    need_comma = true;
+  }
+
+  void value(bool val) {
+    separate();
+    buff += val ? "true" : "false";
+    need_comma = true;
+  }
+
+  void value(int val) { value((long)val); }
+
+  void value(long val) {
+    separate();
+    buff += std::to_string(val);
+    need_comma = true;
+  }
+
+  void value(unsigned long val) {
+    separate();
+    buff += std::to_string(val);
+    need_comma = true;
+  }
+
+  void value(double val);
+
+  // Arrays of anything with a write_json overload
+  template <class T> void value(const std::vector<T> &vals) {
+    start_array();
+    for (const T &val : vals) {
+      write_json(*this, val);
+    }
+    end_array();
+  }
+
+  template <class T> void field(const char *name, const T &val) {
+    key(name);
+    value(val);
+  }
+
+private:
+  void separate() {
+    if (need_comma) {
+      buff += ',';
+    }
+  }
+
+  void write_string(const char *str) { write_string(str, strlen(str)); }
+
+  // Escapes `str`, replacing invalid UTF-8 with U+FFFD
+  void write_string(const char *str, size_t len);
+
+  std::string buff;
+  // whether a value was just finished
+  bool need_comma;
+};
+#endif
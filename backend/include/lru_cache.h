@@ -0,0 +1,151 @@
+#ifndef GUARD_LRU_CACHE_H
+#define GUARD_LRU_CACHE_H
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * Thread-safe LRU cache split into shards that
+ * are locked independently so workers rarely
+ * contend. Every entry has a cost in bytes and a
+ * shard evicts its least recently used entries
+ * once it goes over its share of `capacity`.
+ * Values are handed out as shared pointers so an
+ * evicted value stays alive while still in use.
+ */
+template <class K, class V, class Hash = std::hash<K>,
+          class Eq = std::equal_to<K>>
+class LRUCache {
+public:
+  struct Stats {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t entries;
+    size_t bytes;
+  };
+
+  LRUCache(size_t capacity, size_t nshards)
+      : shards(std::max<size_t>(nshards, 1)),
+        shard_capacity(capacity / shards.size()), hits(0), misses(0),
+        evictions(0) {}
+
+  LRUCache(const LRUCache &other) = delete;
+  LRUCache(LRUCache &&other) = delete;
+  LRUCache &operator=(const LRUCache &other) = delete;
+  LRUCache &operator=(LRUCache &&other) = delete;
+
+  /*
+   * Cached value for `key`, nullptr if there
+   * isn't one. Marks the entry most recently used.
+   */
+  std::shared_ptr<const V> get(const K &key) {
+    Shard &shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.idxs.find(key);
+    if (it == shard.idxs.end()) {
+      misses++;
+      return nullptr;
+    }
+    hits++;
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    return it->second->val;
+  }
+
+  void put(const K &key, std::shared_ptr<const V> val, size_t cost) {
+    Shard &shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.idxs.find(key);
+    if (it != shard.idxs.end()) {
+      shard.bytes -= it->second->cost;
+      shard.entries.erase(it->second);
+      shard.idxs.erase(it);
+    }
+    if (cost > shard_capacity) {
+      return;
+    }
+    shard.entries.push_front({key, std::move(val), cost});
+    shard.idxs[key] = shard.entries.begin();
+    shard.bytes += cost;
+    while (shard.bytes > shard_capacity) {
+      Entry &lru = shard.entries.back();
+      shard.bytes -= lru.cost;
+      shard.idxs.erase(lru.key);
+      shard.entries.pop_back();
+      evictions++;
+    }
+  }
+
+  void erase(const K &key) {
+    Shard &shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.idxs.find(key);
+    if (it != shard.idxs.end()) {
+      shard.bytes -= it->second->cost;
+      shard.entries.erase(it->second);
+      shard.idxs.erase(it);
+    }
+  }
+
+  /*
+   * Erases every entry `pred(key, value)` is true
+   * for. Visits the whole cache so is for rare events.
+   */
+  template <class Pred> void erase_if(Pred pred) {
+    for (Shard &shard : shards) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+        if (pred(it->key, *it->val)) {
+          shard.bytes -= it->cost;
+          shard.idxs.erase(it->key);
+          it = shard.entries.erase(it);
+        } else {
+          it++;
+        }
+      }
+    }
+  }
+
+  Stats stats() {
+    Stats res = {hits, misses, evictions, 0, 0};
+    for (Shard &shard : shards) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      res.entries += shard.entries.size();
+      res.bytes += shard.bytes;
+    }
+    return res;
+  }
+
+private:
+  struct Entry {
+    K key;
+    std::shared_ptr<const V> val;
+    size_t cost;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    // most recently used at the front
+    std::list<Entry> entries;
+    std::unordered_map<K, typename std::list<Entry>::iterator, Hash, Eq> idxs;
+    size_t bytes = 0;
+  };
+
+  inline Shard &shard_for(const K &key) {
+    return shards[Hash()(key) % shards.size()];
+  }
+
+  std::vector<Shard> shards;
+  size_t shard_capacity;
+  std::atomic<size_t> hits;
+  std::atomic<size_t> misses;
+  std::atomic<size_t> evictions;
+};
+#endif
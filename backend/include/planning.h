@@ -24,10 +24,21 @@ struct PlanningApplication {
   std::string to_string() const;
 };
 
-std::vector<PlanningApplication> fetch_planning_apps(CURL *handle, double lat,
-                                                     double lng, int radius);
+/*
+ * Planning applications `radius` meters around
+ * (`lat`,`lng`). Pages after the first are fetched
+ * concurrently on `fetcher`, and locations without
+ * BNG coordinates are converted with `nat_grid`.
+ * `complete` is set false if a page couldn't be
+ * fetched, parsed or converted, so applications
+ * may be missing.
+ */
+std::vector<PlanningApplication>
+fetch_planning_apps(MultiFetcher &fetcher, const NatGridTransform &nat_grid,
+                    double lat, double lng, int radius, bool &complete);
 NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(PlanningApplication, address, description,
                                    size, state, date_received, date_validated,
                                    date_decision, date_decisison_issued,
                                    location)
+void write_json(JsonWriter &writer, const PlanningApplication &plan_app);
 #endif
@@ -0,0 +1,61 @@
+#ifndef GUARD_RESPONSE_H
+#define GUARD_RESPONSE_H
+#include "building.h"
+#include "httplib.h"
+#include "lru_cache.h"
+#include <chrono>
+#include <string>
+#include <vector>
+
+// A /buildings body and the ETag it was sent with
+struct CachedResponse {
+  std::string body;
+  std::string etag;
+  std::chrono::steady_clock::time_point expires;
+};
+
+typedef LRUCache<std::string, CachedResponse> ResponseCache;
+
+/*
+ * /buildings bodies shared by every worker, bounded by the
+ * RESPONSE_CACHE_BYTES config key. Each is kept for
+ * RESPONSE_CACHE_TTL_S seconds, 0 turning the cache off.
+ */
+ResponseCache &response_cache();
+
+std::chrono::seconds response_cache_ttl();
+
+/*
+ * Searches whose centres round to the same point on a
+ * RESPONSE_CACHE_QUANTUM_M metre grid share a response
+ */
+std::string response_cache_key(float x, float y, int rad);
+
+/*
+ * Unique to every response made, so an ETag from
+ * before a restart never matches a new response
+ */
+std::string new_etag();
+
+// Whether an If-None-Match `header` lists `etag`
+bool etag_matches(const std::string &header, const std::string &etag);
+
+/*
+ * Answers from the response cache if it has `key`,
+ * with a 304 if the client already has that response
+ */
+bool send_cached_response(const httplib::Request &req,
+                          httplib::Response &resp, const std::string &key);
+
+/*
+ * Streams {"results":[...],"results_size":n} as chunks of
+ * about RESPONSE_CHUNK_SIZE, serialising buildings only as
+ * the client takes them. Once it's all sent the body goes
+ * into the response cache under `cache_key`, unless it's
+ * not `complete` because some upstream data couldn't be
+ * fetched. Those are sent without an ETag so they're
+ * asked for again rather than revalidated.
+ */
+void stream_buildings(httplib::Response &resp, std::vector<Building> &&res,
+                      const std::string &cache_key, bool complete);
+#endif
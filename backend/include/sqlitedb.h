@@ -3,13 +3,16 @@
 #include "util.h"
 #include <iostream>
 #include <sqlite3.h>
+#include <vector>
 
 class SQLiteDB {
 public:
-  SQLiteDB() : query_buff_sz(1000), conn_success(false) {
-    query_buff = new char[query_buff_sz];
+  SQLiteDB() : conn_success(false) {
     if (sqlite3_open(config("DB_PATH").c_str(), &db) == SQLITE_OK) {
       conn_success = true;
+      // Workers each have their own connection so
+      // wait on each other's writes instead of failing
+      sqlite3_busy_timeout(db, config_long("DB_BUSY_TIMEOUT_MS", 5000));
     } else {
       std::cerr << "Couldn't open database" << std::endl;
     }
@@ -21,18 +24,55 @@ public:
   SQLiteDB &operator=(SQLiteDB &&other) = delete;
 
   ~SQLiteDB() {
+    for (sqlite3_stmt *statement : statements) {
+      sqlite3_finalize(statement);
+    }
     sqlite3_close(db);
-    delete[] query_buff;
   }
 
   inline bool connected() { return conn_success; }
 
 protected:
+  /*
+   * Statements are compiled from `sql` the first time
+   * statement `id` is used and kept for the life of
+   * the connection, so repeat queries skip parsing and
+   * planning. Returned reset with no bindings, or null
+   * if `sql` doesn't compile. Reset it once done with
+   * so it doesn't hold its read transaction open.
+   */
+  sqlite3_stmt *statement(size_t id, const char *sql) {
+    if (id >= statements.size()) {
+      statements.resize(id + 1, nullptr);
+    }
+    sqlite3_stmt *&res = statements[id];
+    if (res == nullptr) {
+      sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &res, NULL);
+    } else {
+      sqlite3_reset(res);
+      sqlite3_clear_bindings(res);
+    }
+    return res;
+  }
+
+  // Runs `sql`, logging `what` failed if it does
+  bool exec(const char *sql, const char *what) {
+    char *err = nullptr;
+    if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+      std::cerr << what << " failed: " << (err ? err : sqlite3_errmsg(db))
+                << std::endl;
+      sqlite3_free(err);
+      return false;
+    }
+    return true;
+  }
+
   sqlite3 *db;
   sqlite3_stmt *stmt;
-  // stores most recently made sql query
-  char *query_buff;
-  size_t query_buff_sz;
   bool conn_success;
+
+private:
+  // prepared statements by id
+  std::vector<sqlite3_stmt *> statements;
 };
 #endif
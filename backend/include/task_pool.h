@@ -0,0 +1,91 @@
+#ifndef GUARD_TASK_POOL_H
+#define GUARD_TASK_POOL_H
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Fixed set of threads running queued tasks, so
+ * work fanned out by a request doesn't start new
+ * threads and the thread count stays bounded under
+ * load. The threads live as long as the pool so
+ * their thread_local state is reused between tasks.
+ * Tasks mustn't wait on other tasks in the same pool.
+ */
+class TaskPool {
+public:
+  TaskPool(size_t nthreads) : stopping(false) {
+    nthreads = std::max<size_t>(nthreads, 1);
+    for (size_t i = 0; i != nthreads; i++) {
+      threads.emplace_back([this] { run(); });
+    }
+  }
+
+  TaskPool(const TaskPool &other) = delete;
+  TaskPool(TaskPool &&other) = delete;
+  TaskPool &operator=(const TaskPool &other) = delete;
+  TaskPool &operator=(TaskPool &&other) = delete;
+
+  // Finishes the queued tasks first
+  ~TaskPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    cv.notify_all();
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+  }
+
+  /*
+   * Queues `fn` to run on one of the threads. Its
+   * result, or what it threw, comes out of the future.
+   */
+  template <class F>
+  std::future<std::invoke_result_t<F>> submit(F fn) {
+    // std::function needs something copyable
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(
+        std::move(fn));
+    std::future<std::invoke_result_t<F>> res = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push([task] { (*task)(); });
+    }
+    cv.notify_one();
+    return res;
+  }
+
+  size_t size() const { return threads.size(); }
+
+private:
+  void run() {
+    std::function<void()> task;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if (tasks.empty()) {
+          return;
+        }
+        task = std::move(tasks.front());
+        tasks.pop();
+      }
+      task();
+    }
+  }
+
+  std::vector<std::thread> threads;
+  std::queue<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool stopping;
+};
+#endif
@@ -10,39 +10,200 @@
 #include <proj.h>
 #include <string>
 #include <unordered_map>
+#include <vector>
+
+/*
+ * WGS84 -> BNG transformation. It's costly to set up so is
+ * made once and kept by its owner, but PJ objects aren't
+ * thread safe so it must only be used by one thread at a time.
+ */
+class NatGridTransform {
+public:
+  NatGridTransform();
+  NatGridTransform(const NatGridTransform &other) = delete;
+  NatGridTransform(NatGridTransform &&other) = delete;
+  NatGridTransform &operator=(const NatGridTransform &other) = delete;
+  NatGridTransform &operator=(NatGridTransform &&other) = delete;
+  ~NatGridTransform();
+
+  inline bool ready() const { return P != nullptr; }
+
+  inline PJ *get() const { return P; }
+
+private:
+  PJ_CONTEXT *ctx;
+  PJ *P;
+};
 
 /*
  * Converts latitude and longitude to British National Grid coords
  * as required by the Ordnance Survey API. Returns 0 on fail,
  * 1 on success.
  */
-int global_to_nat_grid(double lat, double lng, float &x, float &y);
+int global_to_nat_grid(const NatGridTransform &transform, double lat,
+                       double lng, float &x, float &y);
+
+/*
+ * Batch version of `global_to_nat_grid`, converting every
+ * (`lats[i]`,`lngs[i]`) into (`xs[i]`,`ys[i]`) in one call.
+ */
+int global_to_nat_grid(const NatGridTransform &transform,
+                       const std::vector<double> &lats,
+                       const std::vector<double> &lngs, std::vector<float> &xs,
+                       std::vector<float> &ys);
 
 std::string config(const std::string &key);
 
+/*
+ * Integer value of config `key`, `fallback`
+ * if the key isn't set.
+ */
+long config_long(const std::string &key, long fallback);
+
 size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdata);
 
 void make_get_request(CURL *handle, char *url, std::string &data);
 
-template <class T> T get_json_field(nlohmann::json &obj, std::string key) {
-  if (obj.contains(key) && !obj[key].is_null()) {
-    return obj[key].get<T>();
-  }
-  return T();
+/*
+ * Runs batches of GET requests concurrently on
+ * a curl multi handle. Easy handles are kept
+ * between batches so their connections are reused.
+ * Connecting gives up after CONNECT_TIMEOUT_S and a
+ * whole request after REQUEST_TIMEOUT_S seconds.
+ */
+class MultiFetcher {
+public:
+  MultiFetcher();
+  MultiFetcher(const MultiFetcher &other) = delete;
+  MultiFetcher(MultiFetcher &&other) = delete;
+  MultiFetcher &operator=(const MultiFetcher &other) = delete;
+  MultiFetcher &operator=(MultiFetcher &&other) = delete;
+  ~MultiFetcher();
+
+  /*
+   * GET every url in `urls` at once. The body of `urls[i]`
+   * is written into `data[i]` and the result's `i`th element
+   * says whether it was fetched with a 2xx status.
+   */
+  std::vector<bool> get(const std::vector<std::string> &urls,
+                        std::vector<std::string> &data);
+
+  inline bool ready() const { return multi != nullptr; }
+
+private:
+  CURLM *multi;
+  std::vector<CURL *> handles;
+  long connect_timeout, timeout;
 };
 
-template <class T>
-T get_json_fields(nlohmann::json &obj, std::vector<std::string> attempt_keys) {
-  for (const std::string &key : attempt_keys) {
-    if (!obj.contains(key)) {
-      continue;
-    }
-    if (obj[key].is_null()) {
-      break;
-    }
-    return obj[key].get<T>();
+/*
+ * The fields wanted from a JSON object, filled in while
+ * parsing so the object itself is never built. Missing,
+ * null and wrongly typed fields read as empty or 0.
+ */
+class JsonFields {
+public:
+  JsonFields(std::vector<const char *> names);
+
+  // Index of the field called `key`, -1 if it's not wanted
+  int find(const std::string &key) const;
+
+  // Forgets the last object's values
+  void clear();
+
+  void set_null(int field) { states[field] = NULL_VALUE; }
+
+  void set(int field, const std::string &val) {
+    states[field] = STRING;
+    strings[field].assign(val);
   }
-  return T();
+
+  void set(int field, double val) {
+    states[field] = NUMBER;
+    numbers[field] = val;
+  }
+
+  bool has(int field) const { return states[field] != MISSING; }
+
+  bool is_number(int field) const { return states[field] == NUMBER; }
+
+  std::string string(int field) const {
+    return states[field] == STRING ? strings[field] : std::string();
+  }
+
+  /*
+   * The first of `fields` the object has, empty
+   * if that one's null or none of them are there
+   */
+  std::string first_string(std::initializer_list<int> fields) const;
+
+  template <class T> T number(int field) const {
+    return states[field] == NUMBER ? static_cast<T>(numbers[field]) : T();
+  }
+
+private:
+  enum State { MISSING, NULL_VALUE, STRING, NUMBER };
+
+  std::vector<const char *> names;
+  std::vector<State> states;
+  // kept between objects so their capacity is reused
+  std::vector<std::string> strings;
+  std::vector<double> numbers;
+};
+
+/*
+ * Base of the SAX handlers that pick a few fields out of
+ * a page of API results without building the document.
+ * Scalars go into the JsonFields `fields_here` gives for
+ * the object they're in, if any.
+ */
+class JsonPageSax : public nlohmann::json_sax<nlohmann::json> {
+public:
+  JsonPageSax() : depth(0) {}
+
+  // Parses `page`, returning false if it wasn't valid JSON
+  bool parse(const std::string &page);
+
+  bool null() override;
+  bool boolean(bool val) override { return true; }
+  bool number_integer(number_integer_t val) override;
+  bool number_unsigned(number_unsigned_t val) override;
+  bool number_float(number_float_t val, const string_t &s) override;
+  bool string(string_t &val) override;
+  bool binary(binary_t &val) override { return true; }
+  bool start_object(std::size_t elements) override;
+  bool end_object() override;
+  bool start_array(std::size_t elements) override;
+  bool end_array() override;
+  bool key(string_t &val) override;
+  bool parse_error(std::size_t position, const std::string &last_token,
+                   const nlohmann::detail::exception &ex) override;
+
+protected:
+  /*
+   * Whether the current value is at `path`, a key per
+   * enclosing container with "" for array elements
+   */
+  bool at(std::initializer_list<const char *> path) const;
+
+  // Whether the current value is in the object at `path`
+  bool inside(std::initializer_list<const char *> path) const;
+
+  virtual JsonFields *fields_here() = 0;
+
+  // Called with the path at the object either side of its fields
+  virtual void object_started() {}
+  virtual void object_ended() {}
+
+private:
+  // Field of `fields_here` the current value is for, -1 if none
+  JsonFields *current_field(int &field);
+
+  void enter();
+
+  // key each open container is at, reused between pages
+  std::vector<std::string> keys;
+  size_t depth;
 };
 
 inline std::string tabs(int tablevel) { return std::string(tablevel, '\t'); }
@@ -1,5 +1,6 @@
 #ifndef GUARD_VALUATION_H
 #define GUARD_VALUATION_H
+#include "json_writer.h"
 #include "sqlitedb.h"
 #include "util.h"
 #include <algorithm>
@@ -40,7 +41,14 @@ struct Valuation {
   std::string to_string(int tablevel = 0) const;
 };
 
-class ValuationDB : public SQLiteDB {
+/*
+ * Looks up the valuations of buildings by address,
+ * either in SQLite (`ValuationDB`) or in a copy of
+ * the business rates held in memory
+ * (`ValuationSnapshot`), picked by the
+ * VALUATION_ENGINE config key.
+ */
+class ValuationEngine {
 public:
   struct QueryParam {
     const char *building_name;
@@ -50,38 +58,88 @@ public:
   };
   typedef std::vector<Valuation> QueryResult;
 
+  virtual ~ValuationEngine() = default;
+
+  /*
+   * The valuations of the list entries at each param's
+   * postcode and street whose number_or_name is, starts
+   * with, ends with or contains its building name as a
+   * word, in uarn order. Empty for ignored params.
+   */
+  virtual std::vector<QueryResult>
+  get_valuations(std::vector<QueryParam> &params) = 0;
+
+  virtual bool ready() = 0;
+};
+
+class ValuationDB : public ValuationEngine, public SQLiteDB {
 private:
-  typedef std::unordered_map<long, Valuation *> PkToValuationMap;
+  // the valuations of each assessment, several buildings
+  // can share one if their names are too alike
+  typedef std::unordered_map<long, std::vector<Valuation *>> PkToValuationMap;
 
 public:
-  ValuationDB() : SQLiteDB() {}
+  ValuationDB()
+      : SQLiteDB(), tokens_loaded(false), tokens_warned(false),
+        assessments_loaded(false), assessments_warned(false) {}
   ValuationDB(const ValuationDB &other) = delete;
   ValuationDB(ValuationDB &&other) = delete;
   ValuationDB &operator=(const ValuationDB &other) = delete;
   ValuationDB &operator=(ValuationDB &&other) = delete;
 
-  std::vector<QueryResult> get_valuations(std::vector<QueryParam> &params);
+  std::vector<QueryResult>
+  get_valuations(std::vector<QueryParam> &params) override;
+
+  bool ready() override { return connected() && has_assessments(); }
 
 private:
-  void get_valuations(const QueryParam &param, QueryResult &result,
-                      PkToValuationMap &pk_to_valuation);
+  // ids of the prepared statements
+  enum Statement {
+    VALUATIONS_SELECT,
+    VALUATIONS_SCAN_SELECT,
+    TOKENS_SELECT,
+    ASSESSMENTS_SELECT,
+    LINE_ITEMS_SELECT,
+    PLANTS_MACHINERY_SELECT,
+    CAR_PARKS_SELECT
+  };
 
-  int make_valuations_select(const QueryParam &param);
+  /*
+   * Whether list_entry_tokens has been built. Until it
+   * has, every name is matched by scanning, so checked
+   * again each query until it's found to have rows.
+   */
+  bool has_tokens();
+
+  bool tokens_loaded;
+  // whether the missing tokens have been logged
+  bool tokens_warned;
+
+  /*
+   * Whether current_assessments has been built. Every
+   * lookup joins it so there's nothing to fall back on,
+   * checked again each request until it has rows.
+   */
+  bool has_assessments();
+
+  bool assessments_loaded;
+  // whether the missing assessments have been logged
+  bool assessments_warned;
+
+  // looks up every param that isn't ignored in one query
+  void get_valuations(const std::vector<QueryParam> &params,
+                      std::vector<QueryResult> &results,
+                      PkToValuationMap &pk_to_valuation);
 
+  // `references` is a JSON array of assessment references
   void get_line_items(const std::string &references,
                       PkToValuationMap &ref_to_valuation);
 
-  int make_line_items_select(const std::string &references);
-
   void get_plants_machinery_value(const std::string &references,
                                   PkToValuationMap &ref_to_valuation);
 
-  int make_plants_machinery_select(const std::string &references);
-
   void get_car_parking(const std::string &references,
                        PkToValuationMap &ref_to_valuation);
-
-  int make_car_parks_select(const std::string &references);
 };
 
 // serialisation code
@@ -91,4 +149,7 @@ NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Valuation, building_name,
                                    primary_description, secondary_description,
                                    is_composite, rateable_value,
                                    plants_machinery_value, line_items, parking)
+void write_json(JsonWriter &writer, const LineItem &item);
+void write_json(JsonWriter &writer, const Parking &parking);
+void write_json(JsonWriter &writer, const Valuation &valuation);
 #endif
@@ -0,0 +1,92 @@
+#ifndef GUARD_VALUATION_SNAPSHOT_H
+#define GUARD_VALUATION_SNAPSHOT_H
+#include "valuation.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * Read-only copy of the business rates held in memory
+ * so lookups never touch SQLite. Loaded once from the
+ * database at DB_PATH, which only changes when a VOA
+ * list or change file is loaded, so the server has to
+ * restart to pick changes up. Nothing changes after loading so
+ * every worker shares the same snapshot.
+ */
+class ValuationSnapshot : public ValuationEngine {
+public:
+  ValuationSnapshot();
+  ValuationSnapshot(const ValuationSnapshot &other) = delete;
+  ValuationSnapshot(ValuationSnapshot &&other) = delete;
+  ValuationSnapshot &operator=(const ValuationSnapshot &other) = delete;
+  ValuationSnapshot &operator=(ValuationSnapshot &&other) = delete;
+
+  std::vector<QueryResult>
+  get_valuations(std::vector<QueryParam> &params) override;
+
+  bool ready() override { return loaded; }
+
+  // number of list entries with a current assessment
+  size_t size() const { return names.size(); }
+
+private:
+  // index into `strings`
+  typedef uint32_t StringId;
+
+  bool load_entries(sqlite3 *db);
+
+  bool load_line_items(sqlite3 *db);
+
+  bool load_plants_machinery(sqlite3 *db);
+
+  bool load_car_parks(sqlite3 *db);
+
+  StringId intern(const unsigned char *str);
+
+  void add_valuation(uint32_t entry, QueryResult &res) const;
+
+  // every distinct string, descriptions repeat a lot
+  std::vector<std::string> strings;
+  // only used while loading
+  std::unordered_map<std::string, StringId> string_ids;
+
+  // List entries as columns, sorted by (postcode,
+  // street, uarn) so each street's are contiguous
+  std::vector<StringId> names;
+  std::vector<StringId> primary_descriptions;
+  std::vector<StringId> secondary_descriptions;
+  std::vector<bool> composites;
+  std::vector<long> rateable_values;
+  std::vector<long> plants_machinery_values;
+  std::vector<int> parking_spaces;
+  std::vector<long> parking_values;
+
+  // entry i's line items are [item_offsets[i], item_offsets[i+1])
+  std::vector<uint32_t> item_offsets;
+  std::vector<StringId> item_floors;
+  std::vector<StringId> item_descriptions;
+  std::vector<double> item_areas;
+  std::vector<long> item_values;
+
+  // postcode '\n' street -> [begin, end) of its entries
+  std::unordered_map<std::string, std::pair<uint32_t, uint32_t>> streets;
+  // assessment reference -> entry, only used while loading
+  std::unordered_map<long, uint32_t> reference_entries;
+
+  bool loaded;
+};
+
+/*
+ * Whether the VALUATION_ENGINE config key picks
+ * the in-memory snapshot over SQLite.
+ */
+bool use_valuation_snapshot();
+
+/*
+ * The snapshot shared by every worker, loaded
+ * the first time it's asked for.
+ */
+ValuationSnapshot &valuation_snapshot();
+#endif
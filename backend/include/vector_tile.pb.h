@@ -1754,6 +1754,7 @@ class Tile_BuildingShape final :
   enum : int {
     kApproxCentreFieldNumber = 2,
     kEdgesFieldNumber = 3,
+    kPenaltiesFieldNumber = 4,
     kOsidFieldNumber = 1,
   };
   // repeated int32 approx_centre = 2;
@@ -1800,6 +1801,28 @@ class Tile_BuildingShape final :
   ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >*
       mutable_edges();
 
+  // repeated int32 penalties = 4 [packed = true];
+  int penalties_size() const;
+  private:
+  int _internal_penalties_size() const;
+  public:
+  void clear_penalties();
+  private:
+  int32_t _internal_penalties(int index) const;
+  const ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >&
+      _internal_penalties() const;
+  void _internal_add_penalties(int32_t value);
+  ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >*
+      _internal_mutable_penalties();
+  public:
+  int32_t penalties(int index) const;
+  void set_penalties(int index, int32_t value);
+  void add_penalties(int32_t value);
+  const ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >&
+      penalties() const;
+  ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >*
+      mutable_penalties();
+
   // required string osid = 1;
   bool has_osid() const;
   private:
@@ -1830,6 +1853,8 @@ class Tile_BuildingShape final :
     mutable ::PROTOBUF_NAMESPACE_ID::internal::CachedSize _cached_size_;
     ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t > approx_centre_;
     ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t > edges_;
+    ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t > penalties_;
+    mutable std::atomic<int> _penalties_cached_byte_size_;
     ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr osid_;
   };
   union { Impl_ _impl_; };
@@ -1968,6 +1993,7 @@ class Tile final :
 
   enum : int {
     kShapesFieldNumber = 1,
+    kInteriorShapesFieldNumber = 2,
   };
   // repeated .vector_tile.Tile.BuildingShape shapes = 1;
   int shapes_size() const;
@@ -1987,6 +2013,28 @@ class Tile final :
   const ::PROTOBUF_NAMESPACE_ID::RepeatedPtrField< ::vector_tile::Tile_BuildingShape >&
       shapes() const;
 
+  // repeated int32 interior_shapes = 2 [packed = true];
+  int interior_shapes_size() const;
+  private:
+  int _internal_interior_shapes_size() const;
+  public:
+  void clear_interior_shapes();
+  private:
+  int32_t _internal_interior_shapes(int index) const;
+  const ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >&
+      _internal_interior_shapes() const;
+  void _internal_add_interior_shapes(int32_t value);
+  ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >*
+      _internal_mutable_interior_shapes();
+  public:
+  int32_t interior_shapes(int index) const;
+  void set_interior_shapes(int index, int32_t value);
+  void add_interior_shapes(int32_t value);
+  const ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >&
+      interior_shapes() const;
+  ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >*
+      mutable_interior_shapes();
+
   // @@protoc_insertion_point(class_scope:vector_tile.Tile)
  private:
   class _Internal;
@@ -1996,6 +2044,8 @@ class Tile final :
   typedef void DestructorSkippable_;
   struct Impl_ {
     ::PROTOBUF_NAMESPACE_ID::RepeatedPtrField< ::vector_tile::Tile_BuildingShape > shapes_;
+    ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t > interior_shapes_;
+    mutable std::atomic<int> _interior_shapes_cached_byte_size_;
     mutable ::PROTOBUF_NAMESPACE_ID::internal::CachedSize _cached_size_;
   };
   union { Impl_ _impl_; };
@@ -2896,6 +2946,53 @@ Tile_BuildingShape::mutable_edges() {
   return _internal_mutable_edges();
 }
 
+// repeated int32 penalties = 4 [packed = true];
+inline int Tile_BuildingShape::_internal_penalties_size() const {
+  return _impl_.penalties_.size();
+}
+inline int Tile_BuildingShape::penalties_size() const {
+  return _internal_penalties_size();
+}
+inline void Tile_BuildingShape::clear_penalties() {
+  _impl_.penalties_.Clear();
+}
+inline int32_t Tile_BuildingShape::_internal_penalties(int index) const {
+  return _impl_.penalties_.Get(index);
+}
+inline int32_t Tile_BuildingShape::penalties(int index) const {
+  // @@protoc_insertion_point(field_get:vector_tile.Tile.BuildingShape.penalties)
+  return _internal_penalties(index);
+}
+inline void Tile_BuildingShape::set_penalties(int index, int32_t value) {
+  _impl_.penalties_.Set(index, value);
+  // @@protoc_insertion_point(field_set:vector_tile.Tile.BuildingShape.penalties)
+}
+inline void Tile_BuildingShape::_internal_add_penalties(int32_t value) {
+  _impl_.penalties_.Add(value);
+}
+inline void Tile_BuildingShape::add_penalties(int32_t value) {
+  _internal_add_penalties(value);
+  // @@protoc_insertion_point(field_add:vector_tile.Tile.BuildingShape.penalties)
+}
+inline const ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >&
+Tile_BuildingShape::_internal_penalties() const {
+  return _impl_.penalties_;
+}
+inline const ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >&
+Tile_BuildingShape::penalties() const {
+  // @@protoc_insertion_point(field_list:vector_tile.Tile.BuildingShape.penalties)
+  return _internal_penalties();
+}
+inline ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >*
+Tile_BuildingShape::_internal_mutable_penalties() {
+  return &_impl_.penalties_;
+}
+inline ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >*
+Tile_BuildingShape::mutable_penalties() {
+  // @@protoc_insertion_point(field_mutable_list:vector_tile.Tile.BuildingShape.penalties)
+  return _internal_mutable_penalties();
+}
+
 // -------------------------------------------------------------------
 
 // Tile
@@ -2940,6 +3037,53 @@ Tile::shapes() const {
   return _impl_.shapes_;
 }
 
+// repeated int32 interior_shapes = 2 [packed = true];
+inline int Tile::_internal_interior_shapes_size() const {
+  return _impl_.interior_shapes_.size();
+}
+inline int Tile::interior_shapes_size() const {
+  return _internal_interior_shapes_size();
+}
+inline void Tile::clear_interior_shapes() {
+  _impl_.interior_shapes_.Clear();
+}
+inline int32_t Tile::_internal_interior_shapes(int index) const {
+  return _impl_.interior_shapes_.Get(index);
+}
+inline int32_t Tile::interior_shapes(int index) const {
+  // @@protoc_insertion_point(field_get:vector_tile.Tile.interior_shapes)
+  return _internal_interior_shapes(index);
+}
+inline void Tile::set_interior_shapes(int index, int32_t value) {
+  _impl_.interior_shapes_.Set(index, value);
+  // @@protoc_insertion_point(field_set:vector_tile.Tile.interior_shapes)
+}
+inline void Tile::_internal_add_interior_shapes(int32_t value) {
+  _impl_.interior_shapes_.Add(value);
+}
+inline void Tile::add_interior_shapes(int32_t value) {
+  _internal_add_interior_shapes(value);
+  // @@protoc_insertion_point(field_add:vector_tile.Tile.interior_shapes)
+}
+inline const ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >&
+Tile::_internal_interior_shapes() const {
+  return _impl_.interior_shapes_;
+}
+inline const ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >&
+Tile::interior_shapes() const {
+  // @@protoc_insertion_point(field_list:vector_tile.Tile.interior_shapes)
+  return _internal_interior_shapes();
+}
+inline ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >*
+Tile::_internal_mutable_interior_shapes() {
+  return &_impl_.interior_shapes_;
+}
+inline ::PROTOBUF_NAMESPACE_ID::RepeatedField< int32_t >*
+Tile::mutable_interior_shapes() {
+  // @@protoc_insertion_point(field_mutable_list:vector_tile.Tile.interior_shapes)
+  return _internal_mutable_interior_shapes();
+}
+
 #ifdef __GNUC__
   #pragma GCC diagnostic pop
 #endif  // __GNUC__
@@ -0,0 +1,50 @@
+#ifndef GUARD_WORKER_H
+#define GUARD_WORKER_H
+#include "building_shape.h"
+#include "valuation.h"
+#include "valuation_snapshot.h"
+#include <curl/curl.h>
+
+/*
+ * Resources owned by a single server worker
+ * thread. They live as long as the thread does
+ * and are reused across every request it handles
+ * so curl sessions (DNS, TLS, keep-alive) and
+ * sqlite page caches stay warm.
+ * Each upstream API has its own curl handles
+ * so the stages of a request can run concurrently.
+ */
+struct WorkerContext {
+  MultiFetcher places_fetcher;
+  MultiFetcher planit_fetcher;
+  MultiFetcher tiles_fetcher;
+  // used by the worker then the PlanIt stage, never at once
+  NatGridTransform nat_grid;
+  ValuationDB valuation_db;
+  BuildingShapesDB shapes_db;
+
+  WorkerContext() = default;
+  WorkerContext(const WorkerContext &other) = delete;
+  WorkerContext(WorkerContext &&other) = delete;
+  WorkerContext &operator=(const WorkerContext &other) = delete;
+  WorkerContext &operator=(WorkerContext &&other) = delete;
+
+  bool ready();
+
+  // `valuation_db` or the shared snapshot,
+  // picked by the VALUATION_ENGINE config key
+  ValuationEngine &valuations();
+};
+
+/*
+ * `WorkerContext` of the calling thread,
+ * created the first time a thread asks for it.
+ */
+WorkerContext &worker_context();
+
+/*
+ * Number of worker threads the server should run,
+ * read from the SERVER_WORKERS config key.
+ */
+size_t worker_count();
+#endif
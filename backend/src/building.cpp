@@ -57,6 +57,48 @@ std::string Building::to_string(int tablevel) const {
   return res;
 }
 
+void write_json(JsonWriter &writer, const SubUnit &unit) {
+  writer.start_object();
+  writer.field("building_name", unit.building_name);
+  writer.field("code", unit.code);
+  writer.field("description", unit.description);
+  writer.field("is_commercial", unit.is_commercial);
+  writer.field("sub_building_name", unit.sub_building_name);
+  writer.end_object();
+}
+
+void write_json(JsonWriter &writer, TypeOfBuilding tob) {
+  switch (tob) {
+  case COMMERCIAL:
+    writer.value("COMMERCIAL");
+    break;
+  case RESIDENTIAL:
+    writer.value("RESIDENTIAL");
+    break;
+  case DEVELOPMENT:
+    writer.value("DEVELOPMENT");
+    break;
+  default:
+    writer.value("MIXED");
+  }
+}
+
+void write_json(JsonWriter &writer, const Building &building) {
+  writer.start_object();
+  writer.key("location");
+  write_json(writer, building.location);
+  writer.field("name", building.name);
+  writer.field("plan_apps", building.plan_apps);
+  writer.field("postcode", building.postcode);
+  writer.field("street", building.street);
+  writer.field("subunits", building.subunits);
+  writer.key("tob");
+  write_json(writer, building.tob);
+  writer.field("town", building.town);
+  writer.field("valuations", building.valuations);
+  writer.end_object();
+}
+
 void Building::set_tob() {
   tob = subunits[0].is_commercial ? TypeOfBuilding::COMMERCIAL
                                   : TypeOfBuilding::RESIDENTIAL;
@@ -72,54 +114,122 @@ void Building::set_tob() {
 /*
  * Fetching and combination code
  */
-std::vector<Building> fetch_buildings(CURL *handle, float x, float y,
-                                      int radius) {
-  std::vector<Building> buildings;
+/*
+ * Reads pages of OS Places results into `buildings`, each
+ * address becoming a SubUnit of the building with its
+ * building name and street
+ */
+class PlacesPageSax : public JsonPageSax {
+public:
+  PlacesPageSax(std::vector<Building> &buildings)
+      : buildings(buildings), header({"maxresults", "totalresults"}),
+        dpa({"BUILDING_NUMBER", "BUILDING_NAME", "DEPENDENT_THOROUGHFARE_NAME",
+             "THOROUGHFARE_NAME", "POST_TOWN", "POSTCODE", "X_COORDINATE",
+             "Y_COORDINATE", "CLASSIFICATION_CODE",
+             "CLASSIFICATION_CODE_DESCRIPTION", "ORGANISATION_NAME",
+             "SUB_BUILDING_NAME"}) {}
+
+  int page_size() const { return header.number<int>(0); }
+
+  int total() const { return header.number<int>(1); }
+
+private:
+  // indexes into `dpa`
+  enum DpaField {
+    BUILDING_NUMBER,
+    BUILDING_NAME,
+    DEPENDENT_THOROUGHFARE_NAME,
+    THOROUGHFARE_NAME,
+    POST_TOWN,
+    POSTCODE,
+    X_COORDINATE,
+    Y_COORDINATE,
+    CLASSIFICATION_CODE,
+    CLASSIFICATION_CODE_DESCRIPTION,
+    ORGANISATION_NAME,
+    SUB_BUILDING_NAME
+  };
+
+  JsonFields *fields_here() override {
+    if (inside({"results", "", "DPA"})) {
+      return &dpa;
+    }
+    if (inside({"header"})) {
+      return &header;
+    }
+    return nullptr;
+  }
+
+  void object_started() override {
+    if (at({"results", "", "DPA"})) {
+      dpa.clear();
+    }
+  }
+
+  void object_ended() override {
+    if (at({"results", "", "DPA"})) {
+      add_building();
+    }
+  }
+
+  void add_building() {
+    std::string building_name = dpa.first_string(
+        {BUILDING_NUMBER, BUILDING_NAME, DEPENDENT_THOROUGHFARE_NAME});
+    std::string street = dpa.string(THOROUGHFARE_NAME);
+    key = building_name;
+    key += street;
+    auto it = idxs.find(key);
+    if (it == idxs.end()) {
+      buildings.push_back({building_name,
+                           street,
+                           dpa.string(POST_TOWN),
+                           dpa.string(POSTCODE),
+                           {dpa.number<float>(X_COORDINATE),
+                            dpa.number<float>(Y_COORDINATE)}});
+      it = idxs.emplace(key, buildings.size() - 1).first;
+    }
+    std::string classification_code = dpa.string(CLASSIFICATION_CODE);
+    bool is_commercial = classification_code[0] == 'C';
+    buildings[it->second].subunits.push_back(
+        {dpa.first_string({ORGANISATION_NAME, SUB_BUILDING_NAME}),
+         std::move(building_name), classification_code,
+         dpa.string(CLASSIFICATION_CODE_DESCRIPTION), is_commercial});
+  }
+
+  std::vector<Building> &buildings;
+  // building name + street -> index in `buildings`
   std::unordered_map<std::string, size_t> idxs;
-  std::string data;
+  std::string key;
+  JsonFields header, dpa;
+};
+
+std::vector<Building> fetch_buildings(MultiFetcher &fetcher, float x, float y,
+                                      int radius, bool &complete) {
+  std::vector<Building> buildings;
+  std::vector<std::string> urls, pages;
   char url[500];
-  nlohmann::json jdata;
-  bool is_commercial;
-  size_t building_idx;
-  int offset = 0;
+  PlacesPageSax sax(buildings);
+
+  // First page says how many more there are
+  get_os_radius_url(url, 500, x, y, radius, 0);
+  urls.push_back(url);
+  std::vector<bool> fetched = fetcher.get(urls, pages);
+  complete = fetched[0] && sax.parse(pages[0]);
 
-  do {
-    data.clear();
+  // so the rest can be requested at once
+  int page_sz = sax.page_size();
+  int total = sax.total();
+  urls.clear();
+  for (int offset = page_sz; page_sz > 0 && offset < total;
+       offset += page_sz) {
     get_os_radius_url(url, 500, x, y, radius, offset);
-    make_get_request(handle, url, data);
-    jdata = nlohmann::json::parse(data);
-
-    for (nlohmann::json &jb : jdata["results"]) {
-      std::string building_name = get_json_fields<std::string>(
-          jb["DPA"],
-          {"BUILDING_NUMBER", "BUILDING_NAME", "DEPENDENT_THOROUGHFARE_NAME"});
-      std::string street =
-          get_json_field<std::string>(jb["DPA"], "THOROUGHFARE_NAME");
-      std::string key = building_name + street;
-      if (!idxs.count(key)) {
-        buildings.push_back(
-            {building_name,
-             street,
-             get_json_field<std::string>(jb["DPA"], "POST_TOWN"),
-             get_json_field<std::string>(jb["DPA"], "POSTCODE"),
-             {get_json_field<float>(jb["DPA"], "X_COORDINATE"),
-              get_json_field<float>(jb["DPA"], "Y_COORDINATE")}});
-        idxs[key] = buildings.size() - 1;
-      }
-      std::string classification_code =
-          get_json_field<std::string>(jb["DPA"], "CLASSIFICATION_CODE");
-      is_commercial = classification_code[0] == 'C';
-      buildings[idxs[key]].subunits.push_back(
-          {get_json_fields<std::string>(
-               jb["DPA"], std::vector<std::string>(
-                              {"ORGANISATION_NAME", "SUB_BUILDING_NAME"})),
-           std::move(building_name), classification_code,
-           get_json_field<std::string>(jb["DPA"],
-                                       "CLASSIFICATION_CODE_DESCRIPTION"),
-           is_commercial});
-    }
-    offset += get_json_field<int>(jdata["header"], "maxresults");
-  } while (offset < jdata["header"]["totalresults"]);
+    urls.push_back(url);
+  }
+  fetched = fetcher.get(urls, pages);
+  for (int i = 0; i != pages.size(); i++) {
+    complete = fetched[i] && sax.parse(pages[i]) && complete;
+  }
+
   for (Building &b : buildings) {
     b.set_tob();
   }
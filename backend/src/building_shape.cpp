@@ -1,5 +1,6 @@
 #include "../include/building_shape.h"
 #include "../include/sqlitedb.h"
+#include "../include/task_pool.h"
 #include "../include/vector_tile.pb.h"
 #include <algorithm>
 #include <cfloat>
@@ -10,15 +11,22 @@
 #include <curl/curl.h>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <ios>
 #include <iostream>
 #include <iterator>
 #include <limits>
+#include <mutex>
 #include <string>
-#include <unordered_set>
+#include <thread>
+#include <tuple>
 #include <utility>
 #include <vector>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 using namespace vector_tile;
 using BuildingShape = Tile_BuildingShape;
 
@@ -48,6 +56,13 @@ bool operator==(const FPoint &p1, const FPoint &p2) {
   return p1.x == p2.x && p1.y == p2.y;
 }
 
+void write_json(JsonWriter &writer, const FPoint &p) {
+  writer.start_object();
+  writer.field("x", (double)p.x);
+  writer.field("y", (double)p.y);
+  writer.end_object();
+}
+
 /*
  * CoordConverter code
  */
@@ -87,85 +102,251 @@ GridPos CoordConverter::get_tile_row_col(const Point &cell_coord) const {
 std::vector<GridPos>
 BuildingShapesDB::missing_tiles(const std::vector<GridPos> &positions) {
   std::vector<GridPos> res;
-  int query_sz = make_missing_shapes_select(positions);
-  sqlite3_prepare_v2(db, query_buff, query_sz, &stmt, NULL);
+  stmt = statement(MISSING_TILES_SELECT,
+                   "SELECT inp.grid_row, inp.grid_col "
+                   "FROM ("
+                   "  SELECT json_extract(value, '$[0]') grid_row, "
+                   "  json_extract(value, '$[1]') grid_col "
+                   "  FROM json_each(?)) inp "
+                   "  LEFT JOIN tiles_grid gd "
+                   "  ON inp.grid_row = gd.row AND inp.grid_col = gd.col "
+                   "WHERE gd.row IS NULL AND gd.col IS NULL; ");
   if (stmt == nullptr) {
     std::cerr << "Failed to prepare missing building shapes statement"
               << std::endl;
     return res;
   }
+  // [[row, col], ...]
+  std::string inputs = "[";
+  for (int i = 0; i != positions.size(); i++) {
+    if (i > 0) {
+      inputs += ",";
+    }
+    inputs += "[" + std::to_string(positions[i].first) + "," +
+              std::to_string(positions[i].second) + "]";
+  }
+  inputs += "]";
+  sqlite3_bind_text(stmt, /*idx*/ 1, inputs.data(), inputs.size(),
+                    SQLITE_STATIC);
   while (sqlite3_step(stmt) == SQLITE_ROW) {
     res.push_back({/*row*/ sqlite3_column_int(stmt, 0),
                    /*col*/ sqlite3_column_int(stmt, 1)});
   }
-  sqlite3_finalize(stmt);
+  sqlite3_reset(stmt);
   return res;
 }
 
-void BuildingShapesDB::insert(const GridPos &pos, std::string &data) {
-  int query_sz = make_insert(pos);
-  sqlite3_prepare_v2(db, query_buff, query_sz, &stmt, NULL);
+bool BuildingShapesDB::insert(const GridPos &pos, std::string &data) {
+  stmt = statement(TILE_INSERT,
+                   "INSERT OR IGNORE INTO tiles_grid VALUES(?, ?, ?);");
   if (stmt == nullptr) {
     std::cerr << "Failed to prepare tiles_grid insert" << std::endl;
-    return;
+    return false;
   }
-  sqlite3_bind_blob(stmt, /*idx*/ 1, data.data(), data.size(), SQLITE_STATIC);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  sqlite3_bind_int(stmt, /*idx*/ 1, pos.first);
+  sqlite3_bind_int(stmt, /*idx*/ 2, pos.second);
+  sqlite3_bind_blob(stmt, /*idx*/ 3, data.data(), data.size(), SQLITE_STATIC);
+  bool inserted = sqlite3_step(stmt) == SQLITE_DONE;
+  sqlite3_reset(stmt);
+  tile_cache().erase(pos);
+  if (!inserted) {
+    std::cerr << "Failed to insert tile: " << sqlite3_errmsg(db) << std::endl;
+    return false;
+  }
+  if (sqlite3_changes(db) > 0) {
+    remove_combined_tiles(pos);
+  }
+  return true;
+}
+
+bool BuildingShapesDB::insert(const std::vector<GridPos> &positions,
+                              std::vector<std::string> &datas) {
+  if (!exec("BEGIN;", "Begin tiles insert")) {
+    return false;
+  }
+  bool inserted = true;
+  for (int i = 0; inserted && i != positions.size(); i++) {
+    inserted = insert(positions[i], datas[i]);
+  }
+  // a failed COMMIT leaves the transaction open,
+  // which every later write here would then join
+  if (!inserted || !exec("COMMIT;", "Commit tiles insert")) {
+    exec("ROLLBACK;", "Rollback tiles insert");
+    inserted = false;
+  }
+  // anything read while the transaction was open is stale
+  for (const GridPos &pos : positions) {
+    tile_cache().erase(pos);
+  }
+  return inserted;
 }
 
 Tile BuildingShapesDB::tile(const GridPos &pos) {
   Tile res;
-  int query_sz = make_tiles_grid_select(pos);
-  sqlite3_prepare_v2(db, query_buff, query_sz, &stmt, NULL);
+  stmt = statement(TILE_SELECT, "SELECT tile "
+                                "FROM tiles_grid "
+                                "WHERE row = ? AND col = ?;");
   if (stmt == nullptr) {
     std::cerr << "Failed to prepare building shapes select" << std::endl;
     return res;
   }
+  sqlite3_bind_int(stmt, /*idx*/ 1, pos.first);
+  sqlite3_bind_int(stmt, /*idx*/ 2, pos.second);
   if (sqlite3_step(stmt) != SQLITE_ROW) {
     std::cerr << "Failed to execute building shapes select" << std::endl;
   } else {
-    const char *data = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-    res.ParseFromString(data);
+    const void *data = sqlite3_column_blob(stmt, 0);
+    res.ParseFromArray(data, sqlite3_column_bytes(stmt, 0));
   }
-  sqlite3_finalize(stmt);
+  sqlite3_reset(stmt);
   return res;
 }
 
-int BuildingShapesDB::make_missing_shapes_select(
-    const std::vector<GridPos> &positions) {
-  std::string inputs_tbl;
-  for (int i = 0; i != positions.size(); i++) {
-    if (i > 0) {
-      inputs_tbl += " UNION";
-    }
-    inputs_tbl += " SELECT ";
-    inputs_tbl += std::to_string(positions[i].first);
-    inputs_tbl += " grid_row, ";
-    inputs_tbl += std::to_string(positions[i].second);
-    inputs_tbl += " grid_col";
+bool BuildingShapesDB::combined_tile(const std::string &key, Tile &res) {
+  stmt = statement(COMBINED_TILE_SELECT,
+                   "SELECT tile FROM combined_tiles WHERE neighbourhood = ?;");
+  if (stmt == nullptr) {
+    std::cerr << "Failed to prepare combined tiles select" << std::endl;
+    return false;
+  }
+  sqlite3_bind_text(stmt, /*idx*/ 1, key.data(), key.size(), SQLITE_STATIC);
+  bool found = sqlite3_step(stmt) == SQLITE_ROW;
+  if (found) {
+    const void *data = sqlite3_column_blob(stmt, 0);
+    res.ParseFromArray(data, sqlite3_column_bytes(stmt, 0));
+  }
+  sqlite3_reset(stmt);
+  return found;
+}
+
+void BuildingShapesDB::insert_combined_tile(
+    const std::string &key, const std::vector<GridPos> &positions,
+    const Tile &tile) {
+  std::string data;
+  tile.SerializeToString(&data);
+  if (!exec("BEGIN;", "Begin combined tile insert")) {
+    return;
+  }
+  stmt = statement(COMBINED_TILE_INSERT,
+                   "INSERT OR REPLACE INTO combined_tiles VALUES(?, ?);");
+  if (stmt == nullptr) {
+    std::cerr << "Failed to prepare combined tiles insert" << std::endl;
+    exec("ROLLBACK;", "Rollback combined tile insert");
+    return;
+  }
+  sqlite3_bind_text(stmt, /*idx*/ 1, key.data(), key.size(), SQLITE_STATIC);
+  sqlite3_bind_blob(stmt, /*idx*/ 2, data.data(), data.size(), SQLITE_STATIC);
+  sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+
+  stmt = statement(COMBINED_TILE_MEMBERS_INSERT,
+                   "INSERT OR IGNORE INTO combined_tile_members "
+                   "VALUES(?, ?, ?);");
+  if (stmt == nullptr) {
+    std::cerr << "Failed to prepare combined tile members insert" << std::endl;
+    exec("ROLLBACK;", "Rollback combined tile insert");
+    return;
+  }
+  for (const GridPos &pos : positions) {
+    sqlite3_bind_text(stmt, /*idx*/ 1, key.data(), key.size(), SQLITE_STATIC);
+    sqlite3_bind_int(stmt, /*idx*/ 2, pos.first);
+    sqlite3_bind_int(stmt, /*idx*/ 3, pos.second);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  if (!exec("COMMIT;", "Commit combined tile insert")) {
+    exec("ROLLBACK;", "Rollback combined tile insert");
+  }
+}
+
+void BuildingShapesDB::remove_combined_tiles(const GridPos &pos) {
+  stmt = statement(COMBINED_TILES_DELETE,
+                   "DELETE FROM combined_tiles WHERE neighbourhood IN ("
+                   "  SELECT neighbourhood FROM combined_tile_members "
+                   "  WHERE row = ? AND col = ?);");
+  if (stmt == nullptr) {
+    std::cerr << "Failed to prepare combined tiles delete" << std::endl;
+    return;
+  }
+  sqlite3_bind_int(stmt, /*idx*/ 1, pos.first);
+  sqlite3_bind_int(stmt, /*idx*/ 2, pos.second);
+  sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+
+  // the same neighbourhoods, found through the
+  // members still there, rather than scanning for
+  // members without a combined tile
+  stmt = statement(COMBINED_TILE_MEMBERS_DELETE,
+                   "DELETE FROM combined_tile_members WHERE neighbourhood IN ("
+                   "  SELECT neighbourhood FROM combined_tile_members "
+                   "  WHERE row = ? AND col = ?);");
+  if (stmt == nullptr) {
+    std::cerr << "Failed to prepare combined tile members delete"
+              << std::endl;
+    return;
   }
-  return snprintf(query_buff, query_buff_sz,
-                  "SELECT inp.grid_row, inp.grid_col "
-                  "FROM (%s) inp "
-                  "  LEFT JOIN tiles_grid gd "
-                  "  ON inp.grid_row = gd.row AND inp.grid_col = gd.col "
-                  "WHERE gd.row IS NULL AND gd.col IS NULL; ",
-                  inputs_tbl.c_str());
+  sqlite3_bind_int(stmt, /*idx*/ 1, pos.first);
+  sqlite3_bind_int(stmt, /*idx*/ 2, pos.second);
+  sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+  combined_tile_cache().erase_if(
+      [&pos](const std::string &key, const CombinedTile &combined) {
+        return std::find(combined.positions.begin(), combined.positions.end(),
+                         pos) != combined.positions.end();
+      });
 }
 
-int BuildingShapesDB::make_insert(const GridPos &pos) {
-  return snprintf(query_buff, query_buff_sz,
-                  "INSERT INTO tiles_grid VALUES(%d, %d, ?);", pos.first,
-                  pos.second);
+/*
+ * Tile cache code
+ */
+TileCache &tile_cache() {
+  static TileCache cache(config_long("TILE_CACHE_BYTES", 256 << 20),
+                         config_long("TILE_CACHE_SHARDS", 16));
+  return cache;
 }
 
-int BuildingShapesDB::make_tiles_grid_select(const GridPos &pos) {
-  return snprintf(query_buff, query_buff_sz,
-                  "SELECT tile "
-                  "FROM tiles_grid "
-                  "WHERE row = %d AND col = %d;",
-                  pos.first, pos.second);
+std::shared_ptr<const Tile> get_tile(BuildingShapesDB &db,
+                                     const GridPos &pos) {
+  std::shared_ptr<const Tile> res = tile_cache().get(pos);
+  if (!res) {
+    res = std::make_shared<const Tile>(db.tile(pos));
+    tile_cache().put(pos, res, res->SpaceUsedLong());
+  }
+  return res;
+}
+
+CombinedTileCache &combined_tile_cache() {
+  static CombinedTileCache cache(
+      config_long("COMBINED_TILE_CACHE_BYTES", 128 << 20),
+      config_long("TILE_CACHE_SHARDS", 16));
+  return cache;
+}
+
+std::string combined_tile_key(std::vector<GridPos> positions, int centre_row,
+                              int centre_col) {
+  std::sort(positions.begin(), positions.end());
+  std::string res = std::to_string(centre_row) + "," +
+                    std::to_string(centre_col) + ":";
+  for (const GridPos &pos : positions) {
+    res += std::to_string(pos.first) + "," + std::to_string(pos.second) + ";";
+  }
+  return res;
+}
+
+std::vector<GridPos> get_neighbourhood(const std::vector<GridPos> &positions,
+                                       int centre_row, int centre_col) {
+  int rings = 0;
+  for (const GridPos &pos : positions) {
+    rings = std::max({rings, std::abs(pos.first - centre_row),
+                      std::abs(pos.second - centre_col)});
+  }
+  std::vector<GridPos> res;
+  for (int row = centre_row - rings; row <= centre_row + rings; row++) {
+    for (int col = centre_col - rings; col <= centre_col + rings; col++) {
+      res.push_back({row, col});
+    }
+  }
+  return res;
 }
 
 std::string value_to_string(const FullTile_Value &val) {
@@ -353,29 +534,191 @@ Tile parse_tile(std::string &tile_data) {
   BuildingShape *added = res.add_shapes();
   for (const FullTile_Feature &feat : buildings_layer.features()) {
     if (decode_feature(feat, buildings_layer, *added)) {
+      set_edge_penalties(*added);
       added = res.add_shapes();
     }
   }
   res.mutable_shapes()->RemoveLast();
+  set_interior_shapes(res);
   return res;
 }
 
-void fetch_missing_tiles(CURL *handle, char url_buff[], size_t buff_sz,
-                         BuildingShapesDB &db, std::vector<GridPos> &missing) {
-  std::string full_tile_data; // full tile data directly from api
-  std::string tile_data;      // tile data filtered with only the info we need
-  for (const GridPos &pos : missing) {
-    full_tile_data.clear();
-    tile_data.clear();
-    get_tiles_api_url(url_buff, buff_sz, pos.first, pos.second);
-    std::cout << "Fetching tile from " << url_buff << std::endl;
-    make_get_request(handle, url_buff, full_tile_data);
-    Tile tile = parse_tile(full_tile_data);
-    tile.SerializeToString(&tile_data);
-    db.insert(pos, tile_data);
+void set_interior_shapes(Tile &tile) {
+  std::unordered_map<std::string, int> osid_counts;
+  for (const BuildingShape &shape : tile.shapes()) {
+    osid_counts[shape.osid()]++;
+  }
+
+  tile.clear_interior_shapes();
+  for (int i = 0; i != tile.shapes_size(); i++) {
+    const BuildingShape &shape = tile.shapes(i);
+    if (!is_building_shape_valid(shape) || shape.edges_size() == 0 ||
+        shape.edges_size() % 4 != 0 || osid_counts[shape.osid()] != 1) {
+      continue;
+    }
+    bool is_interior = true;
+    for (int j = 0; j != shape.edges_size(); j++) {
+      if (shape.edges(j) <= 0 || shape.edges(j) >= 512) {
+        is_interior = false;
+        break;
+      }
+    }
+    if (is_interior) {
+      tile.add_interior_shapes(i);
+    }
+  }
+}
+
+/*
+ * Threads downloaded tiles are parsed on, TILE_PARSE_THREADS
+ * of them shared by every worker, by default one per core
+ */
+static TaskPool &tile_parse_pool() {
+  static TaskPool pool(config_long("TILE_PARSE_THREADS",
+                                   std::thread::hardware_concurrency()));
+  return pool;
+}
+
+// Tiles currently being downloaded by some request,
+// each future resolves once its tile has been stored
+static std::mutex INFLIGHT_TILES_MUTEX;
+static std::unordered_map<GridPos, std::shared_future<void>, PairHash, PairEq>
+    INFLIGHT_TILES;
+
+/*
+ * Claims the tiles in `missing` no other request is
+ * downloading, adding the rest's futures to `to_await`.
+ * However the download ends, even by an exception, the
+ * claimed tiles are released on destruction and anyone
+ * waiting is woken to find them stored or still missing.
+ */
+class InflightTiles {
+public:
+  InflightTiles(const std::vector<GridPos> &missing,
+                std::vector<std::shared_future<void>> &to_await)
+      : stored_fut(stored.get_future().share()) {
+    std::lock_guard<std::mutex> lock(INFLIGHT_TILES_MUTEX);
+    for (const GridPos &pos : missing) {
+      auto it = INFLIGHT_TILES.find(pos);
+      if (it != INFLIGHT_TILES.end()) {
+        to_await.push_back(it->second);
+      } else {
+        to_fetch.push_back(pos);
+        INFLIGHT_TILES[pos] = stored_fut;
+      }
+    }
+  }
+
+  InflightTiles(const InflightTiles &other) = delete;
+  InflightTiles &operator=(const InflightTiles &other) = delete;
+
+  ~InflightTiles() {
+    {
+      std::lock_guard<std::mutex> lock(INFLIGHT_TILES_MUTEX);
+      for (const GridPos &pos : to_fetch) {
+        INFLIGHT_TILES.erase(pos);
+      }
+    }
+    stored.set_value();
+  }
+
+  // claimed by this request
+  std::vector<GridPos> to_fetch;
+
+private:
+  std::promise<void> stored;
+  std::shared_future<void> stored_fut;
+};
+
+// Downloads, parses and stores the tiles at `to_fetch`
+static void download_tiles(MultiFetcher &fetcher, BuildingShapesDB &db,
+                           const std::vector<GridPos> &to_fetch) {
+  char url[500];
+  std::vector<std::string> urls;
+  for (const GridPos &pos : to_fetch) {
+    get_tiles_api_url(url, 500, pos.first, pos.second);
+    std::cout << "Fetching tile from " << url << std::endl;
+    urls.push_back(url);
+  }
+  // full tile data directly from api
+  std::vector<std::string> full_tile_datas;
+  std::vector<bool> fetched = fetcher.get(urls, full_tile_datas);
+
+  // tile data filtered with only the info we need. Failed
+  // downloads aren't stored so they're still missing and
+  // are fetched again next time
+  std::vector<GridPos> to_store;
+  std::vector<std::future<std::string>> parsed;
+  for (int i = 0; i != to_fetch.size(); i++) {
+    if (!fetched[i]) {
+      continue;
+    }
+    to_store.push_back(to_fetch[i]);
+    std::string &full_tile_data = full_tile_datas[i];
+    parsed.push_back(tile_parse_pool().submit([&full_tile_data] {
+      std::string tile_data;
+      parse_tile(full_tile_data).SerializeToString(&tile_data);
+      return tile_data;
+    }));
+  }
+  // every parse is done with `full_tile_datas` before one can throw
+  for (std::future<std::string> &f : parsed) {
+    f.wait();
+  }
+  std::vector<std::string> tile_datas;
+  std::transform(parsed.begin(), parsed.end(),
+                 std::back_inserter(tile_datas),
+                 [](std::future<std::string> &f) { return f.get(); });
+  if (!to_store.empty()) {
+    db.insert(to_store, tile_datas);
   }
 }
 
+void fetch_missing_tiles(MultiFetcher &fetcher, BuildingShapesDB &db,
+                         const std::vector<GridPos> &missing) {
+  std::vector<std::shared_future<void>> to_await;
+  {
+    InflightTiles inflight(missing, to_await);
+    if (!inflight.to_fetch.empty()) {
+      download_tiles(fetcher, db, inflight.to_fetch);
+    }
+  }
+  // this request's tiles are released before waiting on the
+  // rest, so two requests each waiting on the other's can't
+  // deadlock
+  for (const std::shared_future<void> &f : to_await) {
+    f.wait();
+  }
+}
+
+bool fetch_tiles(MultiFetcher &fetcher, BuildingShapesDB &db,
+                 const std::vector<GridPos> &positions) {
+  std::vector<GridPos> missing = db.missing_tiles(positions);
+  if (missing.empty()) {
+    return true;
+  }
+  fetch_missing_tiles(fetcher, db, missing);
+  // downloads that failed are left missing
+  return db.missing_tiles(missing).empty();
+}
+
+std::vector<GridPos> get_search_grid_positions(const FPoint &centre,
+                                               int radius) {
+  CoordConverter conv(centre);
+  Point top_left, bottom_right;
+  conv.bng_to_cell({centre.x - radius, centre.y + radius}, top_left);
+  conv.bng_to_cell({centre.x + radius, centre.y - radius}, bottom_right);
+  GridPos first = conv.get_tile_row_col(top_left);
+  GridPos last = conv.get_tile_row_col(bottom_right);
+  std::vector<GridPos> res;
+  for (int row = first.first; row <= last.first; row++) {
+    for (int col = first.second; col <= last.second; col++) {
+      res.push_back({row, col});
+    }
+  }
+  return get_neighbourhood(res, conv.get_centre_row(), conv.get_centre_col());
+}
+
 float gradient(int x1, int y1, int x2, int y2) {
   if (x1 != x2) {
     return (y2 - y1) / (x2 - x1 * 1.0f);
@@ -396,53 +739,360 @@ Point midpoint(int x1, int y1, int x2, int y2) {
   return {mid_x, mid_y};
 }
 
-EnclosureType get_enclosure_type(const Point &p, const BuildingShape &shape,
-                                 const EdgeToPenaltyMap &pen_mp) {
-  std::unordered_set<int> above_contacts, below_contacts;
-  int above_penalty = 0, below_penalty = 0, penalty;
-  int x1, y1, x2, y2, contact_y;
-  float grad;
-  Point from, to, before_from, after_to;
-  bool is_before_from_left, is_after_to_left;
-  for (int i = 0; i != shape.edges_size(); i += 4) {
-    x1 = shape.edges(i);
-    y1 = shape.edges(i + 1);
-    x2 = shape.edges(i + 2);
-    y2 = shape.edges(i + 3);
-    if (std::min(x1, x2) > p.x || std::max(x1, x2) < p.x) {
+/*
+ * ShapeStore code
+ */
+ShapeStore::ShapeStore() : ring_offsets({0}), shape_rings({0}) {}
+
+ShapeStore::ShapeStore(const Tile &tile) : ShapeStore() {
+  reserve(tile);
+  for (const BuildingShape &shape : tile.shapes()) {
+    add_shape(shape);
+  }
+}
+
+size_t ShapeStore::bytes() const {
+  return xs.capacity() * sizeof(int32_t) + ys.capacity() * sizeof(int32_t) +
+         penalties.capacity() * sizeof(int8_t) +
+         ring_offsets.capacity() * sizeof(uint32_t) +
+         shape_rings.capacity() * sizeof(uint32_t) +
+         bboxes.capacity() * sizeof(BBox) + centres.capacity() * sizeof(Point);
+}
+
+void ShapeStore::reserve(const Tile &tile) {
+  int nedges = 0;
+  for (const BuildingShape &shape : tile.shapes()) {
+    nedges += shape.edges_size() / 4;
+  }
+  // a closed ring has one vertex per edge plus the repeated start
+  xs.reserve(xs.size() + nedges + tile.shapes_size());
+  ys.reserve(ys.size() + nedges + tile.shapes_size());
+  penalties.reserve(penalties.size() + nedges + tile.shapes_size());
+  bboxes.reserve(bboxes.size() + tile.shapes_size());
+  centres.reserve(centres.size() + tile.shapes_size());
+}
+
+void ShapeStore::add_shape(const BuildingShape &shape, int x_shift,
+                           int y_shift) {
+  BBox bbox = {INT_MAX, INT_MAX, INT_MIN, INT_MIN};
+  int x1, y1, x2, y2;
+  bool has_penalties = shape.penalties_size() == shape.edges_size() / 4;
+  for (int i = 0; i + 3 < shape.edges_size(); i += 4) {
+    x1 = shape.edges(i) + x_shift;
+    y1 = shape.edges(i + 1) + y_shift;
+    x2 = shape.edges(i + 2) + x_shift;
+    y2 = shape.edges(i + 3) + y_shift;
+    // edges that don't carry on from the
+    // previous one start a new ring
+    if (i == 0 || xs.back() != x1 || ys.back() != y1) {
+      if (i != 0) {
+        ring_offsets.push_back(xs.size());
+      }
+      add_vertex(x1, y1, bbox);
+    }
+    if (has_penalties) {
+      penalties.back() = shape.penalties(i / 4);
+    }
+    add_vertex(x2, y2, bbox);
+  }
+  if (shape.edges_size() >= 4) {
+    ring_offsets.push_back(xs.size());
+  }
+  shape_rings.push_back(ring_offsets.size() - 1);
+  bboxes.push_back(bbox);
+  if (is_building_shape_valid(shape)) {
+    centres.push_back(
+        {shape.approx_centre(0) + x_shift, shape.approx_centre(1) + y_shift});
+  } else {
+    centres.push_back({0, 0});
+  }
+  if (!has_penalties) {
+    set_penalties(size() - 1);
+  }
+}
+
+void ShapeStore::add_vertex(int x, int y, BBox &bbox) {
+  xs.push_back(x);
+  ys.push_back(y);
+  penalties.push_back(0);
+  bbox.min_x = std::min(bbox.min_x, x);
+  bbox.min_y = std::min(bbox.min_y, y);
+  bbox.max_x = std::max(bbox.max_x, x);
+  bbox.max_y = std::max(bbox.max_y, y);
+}
+
+void ShapeStore::edge_starts(int shape, std::vector<int> &res) const {
+  res.clear();
+  for (int r = shape_rings[shape]; r != shape_rings[shape + 1]; r++) {
+    for (int v = ring_offsets[r]; v + 1 < ring_offsets[r + 1]; v++) {
+      res.push_back(v);
+    }
+  }
+}
+
+/*
+ * A vertical edge's contacts are both its endpoints
+ * so the ray casting has to discount one of them if
+ * the neighbouring edges carry on to opposite sides
+ * (the ray only crosses the boundary once) or both
+ * if they turn back to the same side (it just skims
+ * the boundary).
+ */
+void ShapeStore::set_penalties(int shape) {
+  thread_local std::vector<int> starts, verticals;
+  edge_starts(shape, starts);
+  verticals.clear();
+  int nedge = starts.size();
+  int from, to, before, after;
+  bool is_before_left, is_after_left;
+  for (int i = 0; i != nedge; i++) {
+    from = starts[i];
+    to = from + 1;
+    if (xs[from] != xs[to]) {
       continue;
     }
-    grad = gradient(x1, y1, x2, y2);
-    if (!isinf(grad)) {
-      contact_y = (p.x - x1) * grad + y1;
-      if (p.y < contact_y) {
-        above_contacts.insert(contact_y);
-      }
-      if (p.y > contact_y) {
-        below_contacts.insert(contact_y);
+    // start of the i-1th edge using mod to wrap around
+    before = starts[floor_mod(i - 1, nedge)];
+    // end of the i+1th edge using mod to wrap around
+    after = starts[floor_mod(i + 1, nedge)] + 1;
+    is_before_left = (xs[before] - xs[from]) < 0;
+    is_after_left = (xs[after] - xs[to]) < 0;
+    penalties[from] = is_before_left == is_after_left ? 2 : 1;
+    verticals.push_back(from);
+  }
+
+  // Penalties used to be looked up by end points so
+  // repeats of the same edge take the last one's penalty
+  std::stable_sort(verticals.begin(), verticals.end(), [this](int a, int b) {
+    return std::make_tuple(xs[a], ys[a], ys[a + 1]) <
+           std::make_tuple(xs[b], ys[b], ys[b + 1]);
+  });
+  for (int i = verticals.size() - 1; i > 0; i--) {
+    int a = verticals[i - 1], b = verticals[i];
+    if (xs[a] == xs[b] && ys[a] == ys[b] && ys[a + 1] == ys[b + 1]) {
+      penalties[a] = penalties[b];
+    }
+  }
+}
+
+void ShapeStore::to_building_shape(int shape, BuildingShape &res) const {
+  for (int r = shape_rings[shape]; r != shape_rings[shape + 1]; r++) {
+    for (int v = ring_offsets[r]; v + 1 < ring_offsets[r + 1]; v++) {
+      res.add_edges(xs[v]);
+      res.add_edges(ys[v]);
+      res.add_edges(xs[v + 1]);
+      res.add_edges(ys[v + 1]);
+      res.add_penalties(penalties[v]);
+    }
+  }
+  res.add_approx_centre(centres[shape].x);
+  res.add_approx_centre(centres[shape].y);
+}
+
+/*
+ * Ray casting kernels
+ *
+ * Each kernel walks a run of edges and collects the y
+ * of every contact the vertical rays through a point
+ * make with them. The SIMD kernels test 8 (AVX2) or 4
+ * (SSE4.1) edges at a time and only drop to the scalar
+ * code for the rare lanes holding a vertical edge in
+ * range of the point. Contacts are computed with the
+ * same float operations in every kernel, so they all
+ * classify points identically.
+ */
+namespace {
+
+struct Contacts {
+  std::vector<int> above, below;
+  int above_penalty = 0, below_penalty = 0;
+};
+
+/*
+ * Returns false if the point lies on a vertical edge
+ */
+inline bool add_contacts(const Point &p, const ShapeStore &store, int v,
+                         Contacts &res) {
+  int x1 = store.xs[v], y1 = store.ys[v];
+  int x2 = store.xs[v + 1], y2 = store.ys[v + 1];
+  if (std::min(x1, x2) > p.x || std::max(x1, x2) < p.x) {
+    return true;
+  }
+  if (x1 != x2) {
+    float grad = gradient(x1, y1, x2, y2);
+    int contact_y = (p.x - x1) * grad + y1;
+    if (p.y < contact_y) {
+      res.above.push_back(contact_y);
+    }
+    if (p.y > contact_y) {
+      res.below.push_back(contact_y);
+    }
+  } else if (std::max(y1, y2) >= p.y && std::min(y1, y2) <= p.y) {
+    return false;
+  } else if (std::min(y1, y2) > p.y) {
+    res.above.push_back(y1);
+    res.above.push_back(y2);
+    res.above_penalty += store.penalties[v];
+  } else {
+    res.below.push_back(y1);
+    res.below.push_back(y2);
+    res.below_penalty += store.penalties[v];
+  }
+  return true;
+}
+
+/*
+ * Every kernel handles the edges starting at vertices
+ * [begin, end) and returns false if the point lies on
+ * a vertical edge
+ */
+typedef bool (*EdgeKernel)(const Point &, const ShapeStore &, int, int,
+                           Contacts &);
+
+bool scalar_kernel(const Point &p, const ShapeStore &store, int begin,
+                   int end, Contacts &res) {
+  for (int v = begin; v != end; v++) {
+    if (!add_contacts(p, store, v, res)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2"))) bool
+avx2_kernel(const Point &p, const ShapeStore &store, int begin, int end,
+            Contacts &res) {
+  const int32_t *xs = store.xs.data(), *ys = store.ys.data();
+  const __m256i px = _mm256_set1_epi32(p.x), py = _mm256_set1_epi32(p.y);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  alignas(32) int32_t contact_ys[8];
+  int v = begin;
+  for (; v + 8 <= end; v += 8) {
+    __m256i x1 = _mm256_loadu_si256((const __m256i *)(xs + v));
+    __m256i x2 = _mm256_loadu_si256((const __m256i *)(xs + v + 1));
+    __m256i out = _mm256_or_si256(
+        _mm256_cmpgt_epi32(_mm256_min_epi32(x1, x2), px),
+        _mm256_cmpgt_epi32(px, _mm256_max_epi32(x1, x2)));
+    int in_range = ~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xff;
+    if (!in_range) {
+      continue;
+    }
+    __m256i vertical = _mm256_cmpeq_epi32(x1, x2);
+    int vertical_mask = _mm256_movemask_ps(_mm256_castsi256_ps(vertical));
+    for (int lanes = in_range & vertical_mask; lanes; lanes &= lanes - 1) {
+      if (!add_contacts(p, store, v + __builtin_ctz(lanes), res)) {
+        return false;
       }
-    } else {
-      if (std::max(y1, y2) >= p.y && std::min(y1, y2) <= p.y) {
-        return EnclosureType::EDGE;
-      } else {
-        from.x = x1;
-        from.y = y1;
-        to.x = x2;
-        to.y = y2;
-        if (std::min(y1, y2) > p.y) {
-          above_contacts.insert(y1);
-          above_contacts.insert(y2);
-          above_penalty += pen_mp.at({from, to});
-        } else {
-          below_contacts.insert(y1);
-          below_contacts.insert(y2);
-          below_penalty += pen_mp.at({from, to});
-        }
+    }
+    int sloped = in_range & ~vertical_mask;
+    if (!sloped) {
+      continue;
+    }
+    __m256i y1 = _mm256_loadu_si256((const __m256i *)(ys + v));
+    __m256i y2 = _mm256_loadu_si256((const __m256i *)(ys + v + 1));
+    __m256 dx = _mm256_sub_ps(_mm256_cvtepi32_ps(x2), _mm256_cvtepi32_ps(x1));
+    dx = _mm256_blendv_ps(dx, one, _mm256_castsi256_ps(vertical));
+    __m256 dy = _mm256_cvtepi32_ps(_mm256_sub_epi32(y2, y1));
+    __m256 grad = _mm256_div_ps(dy, dx);
+    __m256i contact_y = _mm256_cvttps_epi32(_mm256_add_ps(
+        _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(px, x1)), grad),
+        _mm256_cvtepi32_ps(y1)));
+    int above = _mm256_movemask_ps(
+        _mm256_castsi256_ps(_mm256_cmpgt_epi32(contact_y, py)));
+    int below = _mm256_movemask_ps(
+        _mm256_castsi256_ps(_mm256_cmpgt_epi32(py, contact_y)));
+    _mm256_store_si256((__m256i *)contact_ys, contact_y);
+    for (int lanes = sloped & above; lanes; lanes &= lanes - 1) {
+      res.above.push_back(contact_ys[__builtin_ctz(lanes)]);
+    }
+    for (int lanes = sloped & below; lanes; lanes &= lanes - 1) {
+      res.below.push_back(contact_ys[__builtin_ctz(lanes)]);
+    }
+  }
+  return scalar_kernel(p, store, v, end, res);
+}
+
+__attribute__((target("sse4.1"))) bool
+sse_kernel(const Point &p, const ShapeStore &store, int begin, int end,
+           Contacts &res) {
+  const int32_t *xs = store.xs.data(), *ys = store.ys.data();
+  const __m128i px = _mm_set1_epi32(p.x), py = _mm_set1_epi32(p.y);
+  const __m128 one = _mm_set1_ps(1.0f);
+  alignas(16) int32_t contact_ys[4];
+  int v = begin;
+  for (; v + 4 <= end; v += 4) {
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(xs + v));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(xs + v + 1));
+    __m128i out = _mm_or_si128(_mm_cmpgt_epi32(_mm_min_epi32(x1, x2), px),
+                               _mm_cmpgt_epi32(px, _mm_max_epi32(x1, x2)));
+    int in_range = ~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xf;
+    if (!in_range) {
+      continue;
+    }
+    __m128i vertical = _mm_cmpeq_epi32(x1, x2);
+    int vertical_mask = _mm_movemask_ps(_mm_castsi128_ps(vertical));
+    for (int lanes = in_range & vertical_mask; lanes; lanes &= lanes - 1) {
+      if (!add_contacts(p, store, v + __builtin_ctz(lanes), res)) {
+        return false;
       }
     }
+    int sloped = in_range & ~vertical_mask;
+    if (!sloped) {
+      continue;
+    }
+    __m128i y1 = _mm_loadu_si128((const __m128i *)(ys + v));
+    __m128i y2 = _mm_loadu_si128((const __m128i *)(ys + v + 1));
+    __m128 dx = _mm_sub_ps(_mm_cvtepi32_ps(x2), _mm_cvtepi32_ps(x1));
+    dx = _mm_blendv_ps(dx, one, _mm_castsi128_ps(vertical));
+    __m128 dy = _mm_cvtepi32_ps(_mm_sub_epi32(y2, y1));
+    __m128 grad = _mm_div_ps(dy, dx);
+    __m128i contact_y = _mm_cvttps_epi32(
+        _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(px, x1)), grad),
+                   _mm_cvtepi32_ps(y1)));
+    int above =
+        _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(contact_y, py)));
+    int below =
+        _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(py, contact_y)));
+    _mm_store_si128((__m128i *)contact_ys, contact_y);
+    for (int lanes = sloped & above; lanes; lanes &= lanes - 1) {
+      res.above.push_back(contact_ys[__builtin_ctz(lanes)]);
+    }
+    for (int lanes = sloped & below; lanes; lanes &= lanes - 1) {
+      res.below.push_back(contact_ys[__builtin_ctz(lanes)]);
+    }
+  }
+  return scalar_kernel(p, store, v, end, res);
+}
+
+#endif
+
+EdgeKernel select_edge_kernel() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return avx2_kernel;
+  } else if (__builtin_cpu_supports("sse4.1")) {
+    return sse_kernel;
   }
-  int nabove_contact = above_contacts.size() - above_penalty;
-  int nbelow_contact = below_contacts.size() - below_penalty;
+#endif
+  return scalar_kernel;
+}
+
+const EdgeKernel EDGE_KERNEL = select_edge_kernel();
+
+/*
+ * Number of distinct values, which leaves contacts in
+ * sorted order
+ */
+int count_distinct(std::vector<int> &contacts) {
+  std::sort(contacts.begin(), contacts.end());
+  return std::unique(contacts.begin(), contacts.end()) - contacts.begin();
+}
+
+EnclosureType contacts_to_enclosure_type(int nabove_contact,
+                                         int nbelow_contact) {
   if ((nabove_contact % 2) != (nbelow_contact % 2)) {
     return EnclosureType::EDGE;
   } else if (nabove_contact % 2 == 0) {
@@ -452,142 +1102,246 @@ EnclosureType get_enclosure_type(const Point &p, const BuildingShape &shape,
   }
 }
 
-EdgeToPenaltyMap edge_to_penalty_map(const BuildingShape &shape) {
-  EdgeToPenaltyMap res;
-  Point from, to, before, after;
-  bool is_before_left, is_after_left;
-  int penalty;
-  int nedge = shape.edges_size() / 4;
-  if (nedge < 3) {
-    return res;
+} // namespace
+
+void set_edge_penalties(BuildingShape &shape) {
+  // cleared so the store works them out
+  shape.clear_penalties();
+  ShapeStore store;
+  store.add_shape(shape);
+  std::vector<int> starts;
+  store.edge_starts(0, starts);
+  for (int v : starts) {
+    shape.add_penalties(store.penalties[v]);
   }
-  for (int i = 0; i != nedge; i++) {
-    from.x = shape.edges(i * 4);
-    from.y = shape.edges(i * 4 + 1);
-    to.x = shape.edges(i * 4 + 2);
-    to.y = shape.edges(i * 4 + 3);
-    // check the i-1th edge using mod to wrap around
-    before.x = shape.edges(floor_mod(i - 1, nedge) * 4);
-    before.y = shape.edges(floor_mod(i - 1, nedge) * 4 + 1);
-    // check the i+1th edge using mod to wrap around
-    after.x = shape.edges(floor_mod(i + 1, nedge) * 4 + 2);
-    after.y = shape.edges(floor_mod(i - 1, nedge) * 4 + 3);
-    if (from.x != to.x) {
-      continue;
+}
+
+EnclosureType get_enclosure_type(const Point &p, const ShapeStore &store,
+                                 int shape) {
+  thread_local Contacts contacts;
+  contacts.above.clear();
+  contacts.below.clear();
+  contacts.above_penalty = 0;
+  contacts.below_penalty = 0;
+  for (int r = store.shape_rings[shape]; r != store.shape_rings[shape + 1];
+       r++) {
+    int begin = store.ring_offsets[r], end = store.ring_offsets[r + 1] - 1;
+    if (begin < end && !EDGE_KERNEL(p, store, begin, end, contacts)) {
+      return EnclosureType::EDGE;
     }
-    is_before_left = (before.x - from.x) < 0;
-    is_after_left = (after.x - to.x) < 0;
-    penalty = is_before_left == is_after_left ? 2 : 1;
-    res[{from, to}] = penalty;
   }
-  return res;
+  int nabove_contact = count_distinct(contacts.above) - contacts.above_penalty;
+  int nbelow_contact = count_distinct(contacts.below) - contacts.below_penalty;
+  return contacts_to_enclosure_type(nabove_contact, nbelow_contact);
 }
 
-std::vector<EdgeToPenaltyMap>
-edge_to_penalty_maps(const vector_tile::Tile &tile) {
-  std::vector<EdgeToPenaltyMap> res;
-  std::transform(
-      tile.shapes().begin(), tile.shapes().end(), std::back_inserter(res),
-      [](const BuildingShape &sh) { return edge_to_penalty_map(sh); });
-  return res;
-}
+/*
+ * ShapeIndex code
+ */
+ShapeIndex::ShapeIndex(const std::vector<BBox> &bboxes)
+    : bboxes(bboxes), bounds({INT_MAX, INT_MAX, INT_MIN, INT_MIN}),
+      bucket_size(1), ncols(0), nrows(0) {
+  int nshapes = bboxes.size();
+  for (const BBox &bbox : bboxes) {
+    if (bbox.min_x > bbox.max_x) {
+      continue; // no edges
+    }
+    bounds.min_x = std::min(bounds.min_x, bbox.min_x);
+    bounds.min_y = std::min(bounds.min_y, bbox.min_y);
+    bounds.max_x = std::max(bounds.max_x, bbox.max_x);
+    bounds.max_y = std::max(bounds.max_y, bbox.max_y);
+  }
+  if (bounds.min_x > bounds.max_x) {
+    bucket_offsets.push_back(0);
+    return; // nothing to index
+  }
 
-void combine_building_shapes(const std::vector<const BuildingShape *> &shapes,
-                             BuildingShape &res) {
-  res.set_osid(shapes[0]->osid());
-  int x1, y1, x2, y2;
-  int min_x = INT_MAX, min_y = INT_MAX, max_x = INT_MIN, max_y = INT_MIN;
-  Point mid;
-  EnclosureType enc_type;
-  bool is_boundry_edge;
-  std::vector<EdgeToPenaltyMap> pen_mps;
-  std::transform(
-      shapes.begin(), shapes.end(), std::back_inserter(pen_mps),
-      [](const BuildingShape *shape) { return edge_to_penalty_map(*shape); });
-  for (const BuildingShape *shape : shapes) {
-    for (int n = 0; n != shape->edges_size(); n += 4) {
-      x1 = shape->edges(n);
-      y1 = shape->edges(n + 1);
-      x2 = shape->edges(n + 2);
-      y2 = shape->edges(n + 3);
-      mid = midpoint(x1, y1, x2, y2);
-      is_boundry_edge = true;
-      for (int j = 0; j != shapes.size(); j++) {
-        enc_type = get_enclosure_type(mid, *shapes[j], pen_mps[j]);
-        if (enc_type == EnclosureType::INSIDE) {
-          is_boundry_edge = false;
-        }
+  // Aim for about one bucket per shape
+  long width = bounds.max_x - bounds.min_x + 1;
+  long height = bounds.max_y - bounds.min_y + 1;
+  bucket_size = std::max(
+      8, static_cast<int>(std::ceil(std::sqrt(width * height / nshapes))));
+  ncols = (width + bucket_size - 1) / bucket_size;
+  nrows = (height + bucket_size - 1) / bucket_size;
+
+  // Count shapes per bucket then fill them in shape
+  // order so every bucket is sorted by shape index
+  bucket_offsets.assign(ncols * nrows + 1, 0);
+  for (int pass = 0; pass != 2; pass++) {
+    std::vector<int> filled;
+    if (pass == 1) {
+      for (int i = 0; i != ncols * nrows; i++) {
+        bucket_offsets[i + 1] += bucket_offsets[i];
       }
-      if (is_boundry_edge) {
-        res.add_edges(x1);
-        res.add_edges(y1);
-        res.add_edges(x2);
-        res.add_edges(y2);
-        min_x = std::min(min_x, std::min(x1, x2));
-        min_y = std::min(min_y, std::min(y1, y2));
-        max_x = std::max(max_x, std::max(x1, x2));
-        max_y = std::max(max_y, std::max(y1, y2));
+      bucket_shapes.resize(bucket_offsets.back());
+      filled.assign(bucket_offsets.begin(), bucket_offsets.end() - 1);
+    }
+    for (int i = 0; i != nshapes; i++) {
+      const BBox &bbox = bboxes[i];
+      if (bbox.min_x > bbox.max_x) {
+        continue;
+      }
+      int first_col = (bbox.min_x - bounds.min_x) / bucket_size;
+      int last_col = (bbox.max_x - bounds.min_x) / bucket_size;
+      int first_row = (bbox.min_y - bounds.min_y) / bucket_size;
+      int last_row = (bbox.max_y - bounds.min_y) / bucket_size;
+      for (int row = first_row; row <= last_row; row++) {
+        for (int col = first_col; col <= last_col; col++) {
+          if (pass == 0) {
+            bucket_offsets[row * ncols + col + 1]++;
+          } else {
+            bucket_shapes[filled[row * ncols + col]++] = i;
+          }
+        }
       }
     }
   }
-  res.add_approx_centre((min_x + max_x) / 2);
-  res.add_approx_centre((min_y + max_y) / 2);
 }
 
-Tile get_combined_tile(CURL *handle, const std::vector<GridPos> &positions,
-                       int centre_row, int centre_col) {
-  Tile res, intermediate_res;
+size_t ShapeIndex::bytes() const {
+  return bucket_offsets.capacity() * sizeof(int) +
+         bucket_shapes.capacity() * sizeof(int);
+}
+
+void ShapeIndex::query(const Point &p, std::vector<int> &res) const {
+  res.clear();
+  if (!bounds.contains(p)) {
+    return;
+  }
+  int col = (p.x - bounds.min_x) / bucket_size;
+  int row = (p.y - bounds.min_y) / bucket_size;
+  int bucket = row * ncols + col;
+  for (int i = bucket_offsets[bucket]; i != bucket_offsets[bucket + 1]; i++) {
+    if (bboxes[bucket_shapes[i]].contains(p)) {
+      res.push_back(bucket_shapes[i]);
+    }
+  }
+}
+
+/*
+ * Copies an interior shape into a combined tile, which
+ * comes out the same as going through a ShapeStore
+ */
+static void add_shifted_shape(const BuildingShape &shape, int x_shift,
+                              int y_shift, BuildingShape &res) {
+  res = shape;
+  for (int i = 0; i + 1 < res.edges_size(); i += 2) {
+    res.set_edges(i, res.edges(i) + x_shift);
+    res.set_edges(i + 1, res.edges(i + 1) + y_shift);
+  }
+  res.set_approx_centre(0, res.approx_centre(0) + x_shift);
+  res.set_approx_centre(1, res.approx_centre(1) + y_shift);
+  if (res.penalties_size() != res.edges_size() / 4) {
+    set_edge_penalties(res);
+  }
+}
+
+/*
+ * Stitches the tiles at `positions` into `res`,
+ * combining the parts of buildings split by tile
+ * borders
+ */
+static void combine_tiles(BuildingShapesDB &db,
+                          const std::vector<GridPos> &positions,
+                          int centre_row, int centre_col, Tile &res) {
   BuildingShape *added;
-  char url[500];
-  BuildingShapesDB db;
-  int x_shift, y_shift, idx;
-  // TODO multimap
+  ShapeStore parts;
+  int x_shift, y_shift;
+  // only border shapes can be parts of split buildings
   std::unordered_map<std::string, std::vector<int>> osid_to_idxs;
+  std::vector<bool> is_interior;
 
-  std::vector<GridPos> missing = db.missing_tiles(positions);
-  fetch_missing_tiles(handle, url, 500, db, missing);
+  // kept alive for their osids
+  std::vector<std::shared_ptr<const Tile>> tiles;
+  std::vector<const std::string *> osids;
   for (const GridPos &pos : positions) {
-    Tile tile = db.tile(pos);
+    tiles.push_back(get_tile(db, pos));
+    const Tile &tile = *tiles.back();
     y_shift = (pos.first - centre_row) * 512;
     x_shift = (pos.second - centre_col) * 512;
-    for (const BuildingShape &building : tile.shapes()) {
-      added = intermediate_res.add_shapes();
-      added->set_osid(building.osid());
-      added->add_approx_centre(building.approx_centre(0) + x_shift);
-      added->add_approx_centre(building.approx_centre(1) + y_shift);
-      for (int i = 0; i + 1 < building.edges_size(); i += 2) {
-        added->add_edges(building.edges(i) + x_shift);
-        added->add_edges(building.edges(i + 1) + y_shift);
+    // tiles stored before the index have no interior
+    // shapes, so all their shapes are matched by osid
+    is_interior.assign(tile.shapes_size(), false);
+    for (int i : tile.interior_shapes()) {
+      if (i >= 0 && i < tile.shapes_size()) {
+        is_interior[i] = true;
+      }
+    }
+    parts.reserve(tile);
+    for (int i = 0; i != tile.shapes_size(); i++) {
+      const BuildingShape &building = tile.shapes(i);
+      if (is_interior[i]) {
+        add_shifted_shape(building, x_shift, y_shift, *res.add_shapes());
+        continue;
       }
-      idx = intermediate_res.shapes_size() - 1;
-      osid_to_idxs[added->osid()].push_back(idx);
+      parts.add_shape(building, x_shift, y_shift);
+      osids.push_back(&building.osid());
+      osid_to_idxs[building.osid()].push_back(parts.size() - 1);
     }
   }
 
-  std::vector<const BuildingShape *> buildings;
   for (auto &p : osid_to_idxs) {
     std::vector<int> &idxs = p.second;
     added = res.add_shapes();
+    added->set_osid(*osids[idxs[0]]);
     if (idxs.size() == 1) {
-      idx = idxs[0];
-      *added = std::move(*intermediate_res.mutable_shapes(idx));
+      parts.to_building_shape(idxs[0], *added);
     } else {
-      buildings.clear();
-      std::transform(
-          idxs.begin(), idxs.end(), std::back_inserter(buildings),
-          [&intermediate_res](int i) { return &intermediate_res.shapes(i); });
-      combine_building_shapes(buildings, *added);
+      combine_building_shapes(parts, idxs, *added);
+      set_edge_penalties(*added);
     }
   }
+}
+
+void CombinedTile::index_shapes() {
+  store = ShapeStore(tile);
+  index = std::make_unique<ShapeIndex>(store.bboxes);
+}
+
+size_t CombinedTile::bytes() const {
+  return tile.SpaceUsedLong() + positions.capacity() * sizeof(GridPos) +
+         store.bytes() + (index ? index->bytes() : 0);
+}
+
+std::shared_ptr<const CombinedTile>
+get_combined_tile(MultiFetcher &fetcher, BuildingShapesDB &db,
+                  const std::vector<GridPos> &positions, int centre_row,
+                  int centre_col) {
+  std::vector<GridPos> neighbourhood =
+      get_neighbourhood(positions, centre_row, centre_col);
+  std::string key = combined_tile_key(neighbourhood, centre_row, centre_col);
+  std::shared_ptr<const CombinedTile> cached = combined_tile_cache().get(key);
+  if (cached) {
+    return cached;
+  }
+
+  std::shared_ptr<CombinedTile> res = std::make_shared<CombinedTile>();
+  res->positions = neighbourhood;
+  if (!db.combined_tile(key, res->tile)) {
+    fetch_tiles(fetcher, db, neighbourhood);
+    combine_tiles(db, neighbourhood, centre_row, centre_col, res->tile);
+    // a neighbourhood with tiles that couldn't be
+    // stored would be combined differently next time
+    res->complete = db.missing_tiles(neighbourhood).empty();
+    if (res->complete) {
+      db.insert_combined_tile(key, neighbourhood, res->tile);
+    }
+  }
+  res->index_shapes();
+  if (res->complete) {
+    combined_tile_cache().put(key, res, res->bytes());
+  }
   return res;
 }
 
-void translate_point_to_building_centre(
-    Point &p, const Tile &tile, std::vector<EdgeToPenaltyMap> &pen_mps) {
+void translate_point_to_building_centre(Point &p, const ShapeStore &store,
+                                        const ShapeIndex &index) {
   EnclosureType enc_type;
-  for (int i = 0; i != tile.shapes_size(); i++) {
-    const BuildingShape &shape = tile.shapes(i);
-    enc_type = get_enclosure_type(p, shape, pen_mps[i]);
+  // reused between calls to save reallocating
+  thread_local std::vector<int> candidates;
+  index.query(p, candidates);
+  for (int i : candidates) {
+    enc_type = get_enclosure_type(p, store, i);
     // TODO fix bug where builings incorrectly grouped
     // using radius = 30 and location = office
     // so we can count EDGE points as inside again
@@ -596,13 +1350,287 @@ void translate_point_to_building_centre(
     if (enc_type != EnclosureType::INSIDE) {
       continue;
     }
-    p.x = shape.approx_centre(0);
-    p.y = shape.approx_centre(1);
+    p = store.centres[i];
     return;
   }
 }
 
-void translate_points_to_building_centres(CURL *handle,
+/*
+ * Number of distinct values in [first, last)
+ */
+static int count_distinct(int *first, int *last) {
+  std::sort(first, last);
+  return std::unique(first, last) - first;
+}
+
+/*
+ * Classifies the `group` of points, sorted by x, against
+ * one shape. Every edge is visited once and only meets the
+ * points within its x range, found by binary search.
+ */
+static void get_enclosure_types(const std::vector<Point> &points,
+                                const std::vector<int> &group,
+                                const ShapeStore &store, int shape,
+                                std::vector<EnclosureType> &res) {
+  // reused between calls to save reallocating
+  thread_local std::vector<int> group_xs, edge_ranges, starts, contacts;
+  thread_local std::vector<int> nabove, nbelow, above_penalty, below_penalty;
+  thread_local std::vector<bool> on_edge;
+  int m = group.size();
+  group_xs.resize(m);
+  for (int k = 0; k != m; k++) {
+    group_xs[k] = points[group[k]].x;
+  }
+  const int32_t *xs = store.xs.data(), *ys = store.ys.data();
+  int first_edge = store.ring_offsets[store.shape_rings[shape]];
+  int last_edge = store.ring_offsets[store.shape_rings[shape + 1]] - 1;
+
+  // Each edge meets the run of points [lo, hi) in its x
+  // range. Those are found first to size a run of contacts
+  // for every point (using a difference array) so they can
+  // be counted per point rather than sorted all together.
+  edge_ranges.resize(2 * (last_edge - first_edge + 1));
+  starts.assign(m + 1, 0);
+  for (int r = store.shape_rings[shape]; r != store.shape_rings[shape + 1];
+       r++) {
+    for (int v = store.ring_offsets[r]; v + 1 < store.ring_offsets[r + 1];
+         v++) {
+      auto lo = std::lower_bound(group_xs.begin(), group_xs.end(),
+                                 std::min(xs[v], xs[v + 1]));
+      auto hi =
+          std::upper_bound(lo, group_xs.end(), std::max(xs[v], xs[v + 1]));
+      int *range = &edge_ranges[2 * (v - first_edge)];
+      range[0] = lo - group_xs.begin();
+      range[1] = hi - group_xs.begin();
+      int ncontact = xs[v] != xs[v + 1] ? 1 : 2;
+      starts[range[0]] += ncontact;
+      starts[range[1]] -= ncontact;
+    }
+  }
+  int ncontact = 0, total = 0;
+  for (int k = 0; k != m + 1; k++) {
+    ncontact += starts[k];
+    starts[k] = total;
+    total += ncontact;
+  }
+  contacts.resize(total);
+
+  // Above contacts fill each point's run from the front
+  // and below contacts from the back
+  nabove.assign(m, 0);
+  nbelow.assign(m, 0);
+  above_penalty.assign(m, 0);
+  below_penalty.assign(m, 0);
+  on_edge.assign(m, false);
+  for (int r = store.shape_rings[shape]; r != store.shape_rings[shape + 1];
+       r++) {
+    for (int v = store.ring_offsets[r]; v + 1 < store.ring_offsets[r + 1];
+         v++) {
+      int x1 = xs[v], y1 = ys[v], x2 = xs[v + 1], y2 = ys[v + 1];
+      const int *range = &edge_ranges[2 * (v - first_edge)];
+      if (x1 != x2) {
+        float grad = gradient(x1, y1, x2, y2);
+        for (int k = range[0]; k != range[1]; k++) {
+          const Point &p = points[group[k]];
+          int contact_y = (p.x - x1) * grad + y1;
+          if (p.y < contact_y) {
+            contacts[starts[k] + nabove[k]++] = contact_y;
+          }
+          if (p.y > contact_y) {
+            contacts[starts[k + 1] - ++nbelow[k]] = contact_y;
+          }
+        }
+        continue;
+      }
+      for (int k = range[0]; k != range[1]; k++) {
+        const Point &p = points[group[k]];
+        if (std::max(y1, y2) >= p.y && std::min(y1, y2) <= p.y) {
+          on_edge[k] = true;
+        } else if (std::min(y1, y2) > p.y) {
+          contacts[starts[k] + nabove[k]++] = y1;
+          contacts[starts[k] + nabove[k]++] = y2;
+          above_penalty[k] += store.penalties[v];
+        } else {
+          contacts[starts[k + 1] - ++nbelow[k]] = y1;
+          contacts[starts[k + 1] - ++nbelow[k]] = y2;
+          below_penalty[k] += store.penalties[v];
+        }
+      }
+    }
+  }
+
+  res.resize(m);
+  for (int k = 0; k != m; k++) {
+    if (on_edge[k]) {
+      res[k] = EnclosureType::EDGE;
+      continue;
+    }
+    int *run = contacts.data() + starts[k];
+    int *run_end = contacts.data() + starts[k + 1];
+    int nabove_contact =
+        count_distinct(run, run + nabove[k]) - above_penalty[k];
+    int nbelow_contact =
+        count_distinct(run_end - nbelow[k], run_end) - below_penalty[k];
+    res[k] = contacts_to_enclosure_type(nabove_contact, nbelow_contact);
+  }
+}
+
+/*
+ * Sweeping only beats running a shape's edges through the
+ * SIMD kernel once per point when the shape has at least
+ * this many edges and points, see bench_batch_translate
+ */
+static const int SWEEP_MIN_EDGES = 128;
+static const size_t SWEEP_MIN_POINTS = 16;
+
+/*
+ * Classifies the `group` of points against one shape,
+ * sweeping its edges if there are enough points.
+ * `group` may be reordered, `res` follows its order.
+ */
+static void classify_points(const std::vector<Point> &points,
+                            std::vector<int> &group, const ShapeStore &store,
+                            int shape, std::vector<EnclosureType> &res) {
+  res.resize(group.size());
+  if (group.size() < SWEEP_MIN_POINTS) {
+    for (size_t k = 0; k != group.size(); k++) {
+      res[k] = get_enclosure_type(points[group[k]], store, shape);
+    }
+    return;
+  }
+  std::sort(group.begin(), group.end(), [&points](int a, int b) {
+    return points[a].x < points[b].x;
+  });
+  get_enclosure_types(points, group, store, shape, res);
+}
+
+void get_enclosing_shapes(const std::vector<Point> &points,
+                          const ShapeStore &store, const ShapeIndex &index,
+                          std::vector<int> &res) {
+  int n = points.size();
+  res.assign(n, -1);
+
+  // Small shapes, like most houses, are classified per
+  // point straight away. Large ones are left as (shape,
+  // point) pairs to be swept once per shape. Either way a
+  // point takes the first shape it's inside.
+  std::vector<std::pair<int, int>> pairs;
+  std::vector<int> shapes;
+  for (int i = 0; i != n; i++) {
+    index.query(points[i], shapes);
+    for (int shape : shapes) {
+      if (store.edge_count(shape) >= SWEEP_MIN_EDGES) {
+        pairs.push_back({shape, i});
+      } else if (get_enclosure_type(points[i], store, shape) ==
+                 EnclosureType::INSIDE) {
+        // EDGE points aren't counted as inside, see
+        // translate_point_to_building_centre
+        res[i] = shape;
+        break;
+      }
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
+
+  std::vector<int> group;
+  std::vector<EnclosureType> enc_types;
+  for (size_t beg = 0, end; beg != pairs.size(); beg = end) {
+    int shape = pairs[beg].first;
+    group.clear();
+    for (end = beg; end != pairs.size() && pairs[end].first == shape; end++) {
+      int i = pairs[end].second;
+      // shapes are in order so later ones can't be first
+      if (res[i] == -1 || res[i] > shape) {
+        group.push_back(i);
+      }
+    }
+    classify_points(points, group, store, shape, enc_types);
+    for (size_t k = 0; k != group.size(); k++) {
+      if (enc_types[k] == EnclosureType::INSIDE) {
+        res[group[k]] = shape;
+      }
+    }
+  }
+}
+
+void combine_building_shapes(const ShapeStore &store,
+                             const std::vector<int> &shapes,
+                             BuildingShape &res) {
+  int x1, y1, x2, y2;
+  int min_x = INT_MAX, min_y = INT_MAX, max_x = INT_MIN, max_y = INT_MIN;
+  int nshape = shapes.size();
+  const int32_t *xs = store.xs.data(), *ys = store.ys.data();
+
+  // the midpoint of every edge and the part it's from
+  std::vector<int> edges, owners, starts;
+  std::vector<Point> mids;
+  std::vector<BBox> bboxes;
+  for (int s = 0; s != nshape; s++) {
+    bboxes.push_back(store.bboxes[shapes[s]]);
+    store.edge_starts(shapes[s], starts);
+    for (int v : starts) {
+      edges.push_back(v);
+      owners.push_back(s);
+      mids.push_back(midpoint(xs[v], ys[v], xs[v + 1], ys[v + 1]));
+    }
+  }
+
+  // An edge is internal if its midpoint is inside one of
+  // the other parts, which only need testing if their
+  // bbox holds it. Its own part would at most find it
+  // on the EDGE.
+  ShapeIndex index(bboxes);
+  std::vector<std::vector<int>> groups(nshape);
+  std::vector<int> candidates;
+  for (size_t e = 0; e != mids.size(); e++) {
+    index.query(mids[e], candidates);
+    for (int s : candidates) {
+      if (s != owners[e]) {
+        groups[s].push_back(e);
+      }
+    }
+  }
+  std::vector<bool> is_internal(mids.size(), false);
+  std::vector<int> group;
+  std::vector<EnclosureType> enc_types;
+  for (int s = 0; s != nshape; s++) {
+    group.clear();
+    for (int e : groups[s]) {
+      if (!is_internal[e]) {
+        group.push_back(e);
+      }
+    }
+    classify_points(mids, group, store, shapes[s], enc_types);
+    for (size_t k = 0; k != group.size(); k++) {
+      if (enc_types[k] == EnclosureType::INSIDE) {
+        is_internal[group[k]] = true;
+      }
+    }
+  }
+
+  for (size_t e = 0; e != edges.size(); e++) {
+    if (is_internal[e]) {
+      continue;
+    }
+    x1 = xs[edges[e]];
+    y1 = ys[edges[e]];
+    x2 = xs[edges[e] + 1];
+    y2 = ys[edges[e] + 1];
+    res.add_edges(x1);
+    res.add_edges(y1);
+    res.add_edges(x2);
+    res.add_edges(y2);
+    min_x = std::min(min_x, std::min(x1, x2));
+    min_y = std::min(min_y, std::min(y1, y2));
+    max_x = std::max(max_x, std::max(x1, x2));
+    max_y = std::max(max_y, std::max(y1, y2));
+  }
+  res.add_approx_centre((min_x + max_x) / 2);
+  res.add_approx_centre((min_y + max_y) / 2);
+}
+
+bool translate_points_to_building_centres(MultiFetcher &fetcher,
+                                          BuildingShapesDB &db,
                                           std::vector<FPoint *> &bng_coords,
                                           FPoint centre) {
   int n = bng_coords.size();
@@ -620,13 +1648,19 @@ void translate_points_to_building_centres(CURL *handle,
       set.insert(gp);
     }
   }
-  Tile tile = get_combined_tile(handle, grid_positions, conv.get_centre_row(),
-                                conv.get_centre_col());
-  std::vector<EdgeToPenaltyMap> pen_mps = edge_to_penalty_maps(tile);
-  for (Point &p : cell_coords) {
-    translate_point_to_building_centre(p, tile, pen_mps);
+  std::shared_ptr<const CombinedTile> combined = get_combined_tile(
+      fetcher, db, grid_positions, conv.get_centre_row(),
+      conv.get_centre_col());
+  std::vector<int> enclosing;
+  get_enclosing_shapes(cell_coords, combined->store, *combined->index,
+                       enclosing);
+  for (int i = 0; i != n; i++) {
+    if (enclosing[i] != -1) {
+      cell_coords[i] = combined->store.centres[enclosing[i]];
+    }
   }
   for (int i = 0; i != n; i++) {
     conv.cell_to_bng(cell_coords[i], *bng_coords[i]);
   }
+  return combined->complete;
 }
@@ -0,0 +1,37 @@
+-- Brings current_assessments and list_entry_tokens up to date after
+-- load_valuations --apply, the same as current_assessments.sql and
+-- list_entry_tokens.sql but only for the uarns it put in its temp tables.
+-- Run inside its transaction, it's already deleted the changed list
+-- entries' old tokens.
+DELETE FROM current_assessments
+WHERE uarn IN (SELECT uarn FROM changed_uarns);
+
+INSERT INTO current_assessments
+SELECT le.uarn, rle.assessment_reference, le.number_or_name,
+	   le.primary_description_text, sc.description_text,
+	   le.composite_indicator, le.rateable_value
+FROM list_entries le
+  INNER JOIN (
+	SELECT uarn, assessment_reference, ROW_NUMBER() OVER (
+	  PARTITION BY uarn ORDER BY from_date DESC, assessment_reference DESC) rn
+	FROM related_list_entries
+	WHERE uarn IN (SELECT uarn FROM changed_uarns)) rle
+  ON le.uarn = rle.uarn AND rle.rn = 1
+  INNER JOIN scat_codes sc
+  ON le.scat_code_and_suffix = sc.scat_code_and_suffix
+WHERE le.uarn IN (SELECT uarn FROM changed_uarns);
+
+INSERT OR IGNORE INTO list_entry_tokens
+WITH RECURSIVE split(uarn, postcode, street, token, rest) AS (
+	SELECT uarn, postcode, street, '', number_or_name || ' '
+	FROM list_entries
+	WHERE uarn IN (SELECT uarn FROM changed_list_entries)
+	UNION ALL
+	SELECT uarn, postcode, street, substr(rest, 1, instr(rest, ' ') - 1),
+		   substr(rest, instr(rest, ' ') + 1)
+	FROM split
+	WHERE rest <> ''
+)
+SELECT postcode, street, lower(token), uarn
+FROM split
+WHERE token <> '';
@@ -0,0 +1,21 @@
+-- Rebuilds current_assessments, run after importing the valuation lists
+-- so lookups don't have to find each list entry's latest assessment.
+-- apply_changes.sql does the same for changed list entries.
+BEGIN;
+
+DELETE FROM current_assessments;
+
+INSERT INTO current_assessments
+SELECT le.uarn, rle.assessment_reference, le.number_or_name,
+	   le.primary_description_text, sc.description_text,
+	   le.composite_indicator, le.rateable_value
+FROM list_entries le
+  INNER JOIN (
+	SELECT uarn, assessment_reference, ROW_NUMBER() OVER (
+	  PARTITION BY uarn ORDER BY from_date DESC, assessment_reference DESC) rn
+	FROM related_list_entries) rle
+  ON le.uarn = rle.uarn AND rle.rn = 1
+  INNER JOIN scat_codes sc
+  ON le.scat_code_and_suffix = sc.scat_code_and_suffix;
+
+COMMIT;
@@ -1,94 +1,176 @@
-#include <algorithm>
-#include <ctime>
-#include <fstream>
+#include "voa_records.h"
+#include <cstdio>
 #include <iostream>
-#include <iterator>
+#include <memory>
 #include <string>
 
-using std::copy;
+using std::cerr;
 using std::cout;
 using std::endl;
-using std::find;
-using std::getline;
-using std::ifstream;
-using std::ofstream;
-using std::stoi;
 using std::string;
 
-void convert_to_sqlite_date(string &date) {
-  char converted[11];
-  converted[10] = '\0';
-  struct tm tm;
-  strptime(date.c_str(), "%d-%b-%Y", &tm);
-  strftime(converted, 10, "%Y-%m-%d", &tm);
-  date = string(converted);
-}
+/*
+ * Splits a VOA summary valuations file into a csv per
+ * record type. Every record after an 01 record belongs
+ * to it so gets prefixed with its assessment reference,
+ * and the 01 record's from date gets converted from
+ * DD-MMM-YYYY to YYYY-MM-DD for sqlite. The input is
+ * mmapped and split in place, output is written in
+ * large blocks.
+ */
+
+static const size_t OUT_BLOCK_SIZE = 1 << 22;
+static const long PROGRESS_LINES = 1000000;
+
+/*
+ * Output file written OUT_BLOCK_SIZE bytes at a time.
+ * The first failed write is logged, and close says
+ * whether there was one.
+ */
+class BlockWriter {
+public:
+  BlockWriter(const char *path)
+      : path(path), file(fopen(path, "wb")), failed(false) {
+    buff.reserve(OUT_BLOCK_SIZE);
+  }
+  BlockWriter(const BlockWriter &other) = delete;
+  BlockWriter &operator=(const BlockWriter &other) = delete;
+
+  ~BlockWriter() { close(); }
+
+  bool ok() const { return file != nullptr; }
+
+  // Writes out what's left, whether everything was written
+  bool close() {
+    if (file) {
+      flush();
+      if (fclose(file) != 0) {
+        fail();
+      }
+      file = nullptr;
+    }
+    return !failed;
+  }
+
+  void write(const char *first, const char *last) {
+    if (buff.size() + (last - first) > OUT_BLOCK_SIZE) {
+      flush();
+    }
+    buff.append(first, last);
+  }
+
+  void write(char c) {
+    if (buff.size() == OUT_BLOCK_SIZE) {
+      flush();
+    }
+    buff.push_back(c);
+  }
+
+private:
+  void flush() {
+    if (!failed && fwrite(buff.data(), 1, buff.size(), file) != buff.size()) {
+      fail();
+    }
+    buff.clear();
+  }
+
+  void fail() {
+    if (!failed) {
+      perror((string("Writing ") + path + " failed").c_str());
+      failed = true;
+    }
+  }
+
+  const char *path;
+  FILE *file;
+  string buff;
+  bool failed;
+};
 
 int main(int argc, char *argv[]) {
-  ifstream fin(argv[1]);
-  ofstream fout_related("related.csv"), fout_items("items.csv"),
-      fout_additional_items("additional_items.csv"),
-      fout_plant_machine("plant_machine.csv"), fout_parking("parking.csv"),
-      fout_adj("adj.csv"), fout_adj_tot("adj_tot.csv");
-  ofstream *fout_p;
-  string line, field1, field2, date_from, fk;
-  string::iterator lim1, lim2, date_from_beg, date_from_end;
-  int i = 0;
-  while (getline(fin, line)) {
-    cout << "line " << i++ << endl;
-    lim1 = find(line.begin(), line.end(), '*');
-    field1 = string(line.begin(), lim1);
-    if (field1 == "01") {
-      lim2 = find(lim1 + 1, line.end(), '*');
-      field2 = string(lim1 + 1, lim2);
-      fk = std::move(field2);
-
-      // convert from YYYY-MMM-DD
-      date_from_beg = lim2;
-      for (int i = 0; i != 22; i++) {
-        date_from_beg = find(date_from_beg + 1, line.end(), '*');
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " <summary valuations file>" << endl;
+    return 1;
+  }
+  MappedFile fin(argv[1]);
+  if (!fin.ok()) {
+    cerr << "Couldn't read " << argv[1] << endl;
+    return 1;
+  }
+
+  // indexed by record type
+  std::unique_ptr<BlockWriter> outs[8];
+  const char *paths[8] = {nullptr,
+                          "related.csv",
+                          "items.csv",
+                          "additional_items.csv",
+                          "plant_machine.csv",
+                          "parking.csv",
+                          "adj.csv",
+                          "adj_tot.csv"};
+  for (int i = 1; i != 8; i++) {
+    outs[i] = std::make_unique<BlockWriter>(paths[i]);
+    if (!outs[i]->ok()) {
+      cerr << "Couldn't open " << paths[i] << " for writing" << endl;
+      return 1;
+    }
+  }
+
+  // assessment reference of the last 01 record, points into data
+  const char *fk_beg = nullptr, *fk_end = nullptr;
+  const char *end = fin.end(), *line = fin.begin(), *eol, *lim1,
+             *date_from_beg, *date_from_end;
+  char date_from[10];
+  long i = 0, malformed = 0;
+  int type;
+  while (line < end) {
+    eol = find_char(line, end, '\n');
+    lim1 = find_char(line, eol, '*');
+    type = record_type(line, lim1);
+    if (type < 1 || type > 7) {
+      // the old tool skipped these too, bar crashing on non numbers
+      malformed += type == -1 && line != eol;
+    } else if (is_assessment(line, lim1)) {
+      find_field(line, eol, 1, fk_beg, fk_end);
+      find_field(line, eol, FROM_DATE_FIELD, date_from_beg, date_from_end);
+      if (convert_to_sqlite_date(date_from_beg, date_from_end, date_from)) {
+        outs[type]->write(line, date_from_beg);
+        outs[type]->write(date_from, date_from + 10);
+        outs[type]->write(date_from_end, eol);
+      } else {
+        malformed++;
+        outs[type]->write(line, eol);
       }
-      date_from_beg++;
-      date_from_end = find(date_from_beg, line.end(), '*');
-      date_from = string(date_from_beg, date_from_end);
-      convert_to_sqlite_date(date_from);
-      copy(date_from.begin(), date_from.end(), date_from_beg);
-      line.erase(date_from_end - 1);
+      outs[type]->write('\n');
     } else {
-      for (int i = 0; i != fk.size() + 1; i++) {
-        line.push_back('-');
+      if (fk_beg == nullptr) {
+        malformed++;
+      } else {
+        outs[type]->write(fk_beg, fk_end);
       }
-      copy(line.rbegin() + fk.size() + 1, line.rend(), line.rbegin());
-      copy(fk.begin(), fk.end(), line.begin());
-      line[fk.size()] = '*';
+      outs[type]->write('*');
+      outs[type]->write(line, eol);
+      outs[type]->write('\n');
     }
 
-    switch (stoi(field1)) {
-    case 1:
-      fout_p = &fout_related;
-      break;
-    case 2:
-      fout_p = &fout_items;
-      break;
-    case 3:
-      fout_p = &fout_additional_items;
-      break;
-    case 4:
-      fout_p = &fout_plant_machine;
-      break;
-    case 5:
-      fout_p = &fout_parking;
-      break;
-    case 6:
-      fout_p = &fout_adj;
-      break;
-    case 7:
-      fout_p = &fout_adj_tot;
-      break;
-    default:
-      continue;
+    line = eol + 1;
+    if (++i % PROGRESS_LINES == 0) {
+      cout << "line " << i << " (" << (line - fin.begin()) * 100 / fin.length()
+           << "%)" << endl;
     }
-    *fout_p << line << '\n';
   }
+
+  bool ok = true;
+  for (int j = 1; j != 8; j++) {
+    ok = outs[j]->close() && ok;
+  }
+  if (!ok) {
+    return 1;
+  }
+  cout << i << " lines";
+  if (malformed) {
+    cout << ", " << malformed << " malformed";
+  }
+  cout << endl;
   return 0;
 }
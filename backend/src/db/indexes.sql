@@ -1,6 +1,8 @@
 -- INDEXES
-CREATE INDEX IF NOT EXISTS idx_list_entries_postcode
-ON list_entries(postcode);
+-- covers the address lookup, leaving uarn (the rowid) to join on
+DROP INDEX IF EXISTS idx_list_entries_postcode;
+CREATE INDEX IF NOT EXISTS idx_list_entries_postcode_street_number_or_name
+ON list_entries(postcode, street, number_or_name);
 
 CREATE INDEX IF NOT EXISTS idx_related_list_entries_uarn
 ON related_list_entries(uarn);
@@ -22,3 +24,6 @@ ON adjustments(assessment_reference);
 
 CREATE INDEX IF NOT EXISTS idx_adjustment_totals_assessment_reference
 ON adjustment_totals(assessment_reference);
+
+CREATE INDEX IF NOT EXISTS idx_combined_tile_members_row_col
+ON combined_tile_members(row, col);
@@ -0,0 +1,22 @@
+-- Rebuilds list_entry_tokens, run after importing the valuation lists
+-- so single word building names are matched by an index seek.
+-- apply_changes.sql does the same for changed list entries.
+BEGIN;
+
+DELETE FROM list_entry_tokens;
+
+INSERT OR IGNORE INTO list_entry_tokens
+WITH RECURSIVE split(uarn, postcode, street, token, rest) AS (
+	SELECT uarn, postcode, street, '', number_or_name || ' '
+	FROM list_entries
+	UNION ALL
+	SELECT uarn, postcode, street, substr(rest, 1, instr(rest, ' ') - 1),
+		   substr(rest, instr(rest, ' ') + 1)
+	FROM split
+	WHERE rest <> ''
+)
+SELECT postcode, street, lower(token), uarn
+FROM split
+WHERE token <> '';
+
+COMMIT;
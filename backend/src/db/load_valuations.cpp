@@ -0,0 +1,597 @@
+#include "voa_records.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sqlite3.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+
+/*
+ * Loads the VOA's list entries and summary valuations
+ * extracts straight into the database, replacing the
+ * last list, then builds the indexes and the lookup
+ * tables the server reads. Does what format_valuations,
+ * importing its csvs and running indexes.sql,
+ * current_assessments.sql and list_entry_tokens.sql
+ * did, so it has to be run from this directory.
+ *
+ * It's loaded without a journal into a new database,
+ * <database>.loading, with every table it doesn't load
+ * copied over from <database>, and only renamed over
+ * <database> once it's all loaded. So if it fails the
+ * database is left as it was. The server has to be
+ * stopped as it'd keep reading the old file.
+ *
+ * With --apply the files are VOA change files instead,
+ * whose rows replace the ones they change, along with
+ * everything below a changed 01 record. It all happens
+ * in one transaction on a WAL database so the server
+ * can keep serving the old rows until it commits.
+ */
+
+static const long BATCH_ROWS = 500000;
+static const long PROGRESS_LINES = 1000000;
+
+// Tables the summary valuations are split into, by record type
+static const char *SUMMARY_TABLES[8] = {nullptr,
+                                        "related_list_entries",
+                                        "line_items",
+                                        "additional_items",
+                                        "plant_and_machinery",
+                                        "car_parks",
+                                        "adjustments",
+                                        "adjustment_totals"};
+
+// Rebuilt by a full load rather than copied from the old database
+static const char *LOADED_TABLES =
+    "'list_entries', 'related_list_entries', 'line_items', "
+    "'additional_items', 'plant_and_machinery', 'car_parks', "
+    "'adjustments', 'adjustment_totals', 'current_assessments', "
+    "'list_entry_tokens'";
+
+static bool exec(sqlite3 *db, const string &sql, const char *what) {
+  char *err = nullptr;
+  if (sqlite3_exec(db, sql.c_str(), NULL, NULL, &err) != SQLITE_OK) {
+    cerr << what << " failed: " << (err ? err : "") << endl;
+    sqlite3_free(err);
+    return false;
+  }
+  return true;
+}
+
+static bool exec_file(sqlite3 *db, const char *path) {
+  std::ifstream fin(path);
+  if (!fin) {
+    cerr << "Couldn't read " << path << endl;
+    return false;
+  }
+  std::stringstream sql;
+  sql << fin.rdbuf();
+  cout << "Running " << path << endl;
+  return exec(db, sql.str(), path);
+}
+
+/*
+ * Inserts records into a table, each * separated field
+ * going into the next column. Like sqlite's .import,
+ * extra fields are dropped, missing ones are NULL and
+ * rows that fail are reported and skipped.
+ */
+class TableLoader {
+public:
+  TableLoader(sqlite3 *db, const char *table, bool replace)
+      : table(table), stmt(nullptr), columns(0), rows(0) {
+    sqlite3_stmt *count;
+    sqlite3_prepare_v2(db, "SELECT count(*) FROM pragma_table_info(?);", -1,
+                       &count, NULL);
+    sqlite3_bind_text(count, 1, table, -1, SQLITE_STATIC);
+    if (sqlite3_step(count) == SQLITE_ROW) {
+      columns = sqlite3_column_int(count, 0);
+    }
+    sqlite3_finalize(count);
+    if (columns == 0) {
+      cerr << "No table " << table << endl;
+      return;
+    }
+
+    string insert = replace ? "INSERT OR REPLACE INTO " : "INSERT INTO ";
+    insert += string(table) + " VALUES (?";
+    for (int i = 1; i != columns; i++) {
+      insert += ", ?";
+    }
+    insert += ");";
+    sqlite3_prepare_v3(db, insert.c_str(), -1, SQLITE_PREPARE_PERSISTENT,
+                       &stmt, NULL);
+    if (stmt == nullptr) {
+      cerr << "Failed to prepare " << table << " insert" << endl;
+    }
+  }
+
+  TableLoader(const TableLoader &other) = delete;
+  TableLoader &operator=(const TableLoader &other) = delete;
+
+  ~TableLoader() { sqlite3_finalize(stmt); }
+
+  bool ok() const { return stmt != nullptr; }
+
+  /*
+   * Binds the fields of [first, last) from column
+   * `column` on, counting from 0. Fields are bound
+   * in place so have to outlive the insert.
+   */
+  void bind_record(int column, const char *first, const char *last) {
+    const char *field_end;
+    while (column < columns) {
+      field_end = find_char(first, last, '*');
+      bind(column++, first, field_end);
+      if (field_end == last) {
+        break;
+      }
+      first = field_end + 1;
+    }
+  }
+
+  void bind(int column, const char *first, const char *last) {
+    if (column < columns) {
+      sqlite3_bind_text(stmt, column + 1, first, last - first, SQLITE_STATIC);
+    }
+  }
+
+  bool insert() {
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    if (rc != SQLITE_DONE) {
+      cerr << "Failed to insert into " << table << ": "
+           << sqlite3_errmsg(sqlite3_db_handle(stmt)) << endl;
+      return false;
+    }
+    rows++;
+    return true;
+  }
+
+  long inserted() const { return rows; }
+
+private:
+  const char *table;
+  sqlite3_stmt *stmt;
+  int columns;
+  long rows;
+};
+
+/*
+ * Commits every `batch_rows` rows so the transactions
+ * stay large but bounded, never if it's 0
+ */
+class Batcher {
+public:
+  Batcher(sqlite3 *db, long batch_rows)
+      : db(db), batch_rows(batch_rows), rows(0) {}
+
+  bool add() {
+    return batch_rows == 0 || ++rows % batch_rows != 0 ||
+           exec(db, "COMMIT; BEGIN;", "Commit");
+  }
+
+private:
+  sqlite3 *db;
+  long batch_rows;
+  long rows;
+};
+
+/*
+ * Clears out what the rows of a change file replace
+ * before they're inserted, and notes the uarns they
+ * change in temp tables so apply_changes.sql can
+ * rebuild just their lookup table rows
+ */
+class ChangeTracker {
+public:
+  ChangeTracker(sqlite3 *db) : db(db) {
+    list_entry_insert =
+        prepare("INSERT OR IGNORE INTO changed_list_entries VALUES (?);");
+    uarn_insert = prepare("INSERT OR IGNORE INTO changed_uarns VALUES (?);");
+    // an assessment could move to another list entry
+    old_uarn_insert = prepare("INSERT OR IGNORE INTO changed_uarns "
+                              "SELECT uarn FROM related_list_entries "
+                              "WHERE assessment_reference = ?;");
+    // the list entry's old postcode and street find its tokens
+    tokens_delete = prepare(
+        "DELETE FROM list_entry_tokens "
+        "WHERE postcode = (SELECT postcode FROM list_entries WHERE uarn = ?1) "
+        "AND street = (SELECT street FROM list_entries WHERE uarn = ?1) "
+        "AND uarn = ?1;");
+    for (int i = 2; i != 8; i++) {
+      children_deletes.push_back(prepare(string("DELETE FROM ") +
+                                         SUMMARY_TABLES[i] +
+                                         " WHERE assessment_reference = ?;"));
+    }
+  }
+
+  ChangeTracker(const ChangeTracker &other) = delete;
+  ChangeTracker &operator=(const ChangeTracker &other) = delete;
+
+  ~ChangeTracker() {
+    for (sqlite3_stmt *stmt : statements) {
+      sqlite3_finalize(stmt);
+    }
+  }
+
+  bool ok() const {
+    for (sqlite3_stmt *stmt : statements) {
+      if (stmt == nullptr) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Before the list entry with this uarn is replaced
+  bool list_entry(const char *uarn_beg, const char *uarn_end) {
+    return run(tokens_delete, uarn_beg, uarn_end) &&
+           run(list_entry_insert, uarn_beg, uarn_end) &&
+           run(uarn_insert, uarn_beg, uarn_end);
+  }
+
+  // Before the 01 record with this assessment reference is replaced
+  bool assessment(const char *reference_beg, const char *reference_end,
+                  const char *uarn_beg, const char *uarn_end) {
+    bool res = run(old_uarn_insert, reference_beg, reference_end) &&
+               run(uarn_insert, uarn_beg, uarn_end);
+    for (sqlite3_stmt *stmt : children_deletes) {
+      res = res && run(stmt, reference_beg, reference_end);
+    }
+    return res;
+  }
+
+private:
+  sqlite3_stmt *prepare(const string &sql) {
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v3(db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt,
+                       NULL);
+    if (stmt == nullptr) {
+      cerr << "Failed to prepare " << sql << endl;
+    }
+    statements.push_back(stmt);
+    return stmt;
+  }
+
+  bool run(sqlite3_stmt *stmt, const char *first, const char *last) {
+    sqlite3_bind_text(stmt, 1, first, last - first, SQLITE_STATIC);
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    if (rc != SQLITE_DONE) {
+      cerr << "Failed to apply change: " << sqlite3_errmsg(db) << endl;
+      return false;
+    }
+    return true;
+  }
+
+  sqlite3 *db;
+  sqlite3_stmt *list_entry_insert, *uarn_insert, *old_uarn_insert,
+      *tokens_delete;
+  std::vector<sqlite3_stmt *> children_deletes;
+  // every statement, to finalize
+  std::vector<sqlite3_stmt *> statements;
+};
+
+static void report_progress(long lines, const char *line,
+                            const MappedFile &fin) {
+  if (lines % PROGRESS_LINES == 0) {
+    cout << "line " << lines << " ("
+         << (line - fin.begin()) * 100 / fin.length() << "%)" << endl;
+  }
+}
+
+/*
+ * Loads the list entries in `fin`, `changes` is null
+ * unless applying a change file, when any row failing
+ * fails the lot
+ */
+static bool load_list_entries(sqlite3 *db, const MappedFile &fin,
+                              ChangeTracker *changes) {
+  TableLoader loader(db, "list_entries", changes);
+  if (!loader.ok()) {
+    return false;
+  }
+  Batcher batcher(db, changes ? 0 : BATCH_ROWS);
+  const char *end = fin.end(), *line = fin.begin(), *eol, *uarn_beg,
+             *uarn_end;
+  long lines = 0, failed = 0;
+  while (line < end) {
+    eol = find_char(line, end, '\n');
+    if (eol != line) {
+      if (changes) {
+        find_field(line, eol, LIST_ENTRY_UARN_FIELD, uarn_beg, uarn_end);
+        if (!changes->list_entry(uarn_beg, uarn_end)) {
+          return false;
+        }
+      }
+      loader.bind_record(0, line, eol);
+      if (!loader.insert()) {
+        if (changes) {
+          return false;
+        }
+        failed++;
+      }
+      if (!batcher.add()) {
+        return false;
+      }
+    }
+    line = eol + 1;
+    report_progress(++lines, line, fin);
+  }
+  cout << loader.inserted() << " list entries" << endl;
+  if (failed) {
+    cout << failed << " list entries lines not inserted" << endl;
+  }
+  return true;
+}
+
+// Same as load_list_entries for the summary valuations
+static bool load_summary_valuations(sqlite3 *db, const MappedFile &fin,
+                                    ChangeTracker *changes) {
+  std::vector<std::unique_ptr<TableLoader>> loaders(8);
+  bool ok = true;
+  for (int i = 1; i != 8; i++) {
+    loaders[i] = std::make_unique<TableLoader>(db, SUMMARY_TABLES[i], changes);
+    ok = ok && loaders[i]->ok();
+  }
+  Batcher batcher(db, changes ? 0 : BATCH_ROWS);
+  // assessment reference of the last 01 record, points into fin
+  const char *fk_beg = nullptr, *fk_end = nullptr;
+  const char *end = fin.end(), *line = fin.begin(), *eol, *lim1,
+             *date_from_beg, *date_from_end, *uarn_beg, *uarn_end;
+  char date_from[10];
+  long lines = 0, malformed = 0, failed = 0;
+  int type;
+  TableLoader *loader;
+  while (ok && line < end) {
+    eol = find_char(line, end, '\n');
+    lim1 = find_char(line, eol, '*');
+    type = record_type(line, lim1);
+    if (type < 1 || type > 7) {
+      malformed += type == -1 && line != eol;
+    } else {
+      loader = loaders[type].get();
+      if (is_assessment(line, lim1)) {
+        find_field(line, eol, 1, fk_beg, fk_end);
+        if (changes) {
+          find_field(line, eol, 2, uarn_beg, uarn_end);
+          if (!changes->assessment(fk_beg, fk_end, uarn_beg, uarn_end)) {
+            ok = false;
+            break;
+          }
+        }
+        loader->bind_record(0, line, eol);
+        find_field(line, eol, FROM_DATE_FIELD, date_from_beg, date_from_end);
+        if (convert_to_sqlite_date(date_from_beg, date_from_end, date_from)) {
+          loader->bind(FROM_DATE_FIELD, date_from, date_from + 10);
+        } else {
+          malformed++;
+        }
+      } else {
+        if (fk_beg == nullptr) {
+          malformed++;
+          loader->bind(0, line, line);
+        } else {
+          loader->bind(0, fk_beg, fk_end);
+        }
+        loader->bind_record(1, line, eol);
+      }
+      if (!loader->insert()) {
+        ok = !changes;
+        failed++;
+      }
+      ok = ok && batcher.add();
+    }
+    line = eol + 1;
+    report_progress(++lines, line, fin);
+  }
+
+  for (int i = 1; i != 8; i++) {
+    cout << loaders[i]->inserted() << " " << SUMMARY_TABLES[i] << endl;
+  }
+  if (malformed) {
+    cout << malformed << " malformed summary valuation lines" << endl;
+  }
+  if (failed) {
+    cout << failed << " summary valuation lines not inserted" << endl;
+  }
+  return ok;
+}
+
+/*
+ * Runs the sql of the `live` database's schema objects
+ * of `type` that a full load doesn't rebuild, and that
+ * aren't already in the new one, copying the rows of
+ * tables
+ */
+static bool copy_schema(sqlite3 *db, const char *type) {
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db,
+                     (string("SELECT name, sql FROM live.sqlite_master "
+                             "WHERE type = ?1 AND sql IS NOT NULL "
+                             "AND name NOT LIKE 'sqlite_%' "
+                             "AND tbl_name NOT IN (") +
+                      LOADED_TABLES +
+                      ") AND name NOT IN "
+                      "(SELECT name FROM main.sqlite_master) "
+                      "ORDER BY rowid;")
+                         .c_str(),
+                     -1, &stmt, NULL);
+  sqlite3_bind_text(stmt, 1, type, -1, SQLITE_STATIC);
+  std::vector<std::pair<string, string>> objects;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    objects.push_back({(const char *)sqlite3_column_text(stmt, 0),
+                       (const char *)sqlite3_column_text(stmt, 1)});
+  }
+  if (sqlite3_finalize(stmt) != SQLITE_OK) {
+    cerr << "Reading the old schema failed: " << sqlite3_errmsg(db) << endl;
+    return false;
+  }
+  for (const auto &object : objects) {
+    if (!exec(db, object.second, "Copying the old schema")) {
+      return false;
+    }
+    if (strcmp(type, "table") == 0) {
+      cout << "Copying " << object.first << endl;
+      if (!exec(db,
+                "INSERT INTO main.\"" + object.first +
+                    "\" SELECT * FROM live.\"" + object.first + "\";",
+                "Copying tables")) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/*
+ * Loads into the empty database `db` with the
+ * database being replaced attached as live
+ */
+static bool load(sqlite3 *db, const MappedFile &list_entries,
+                 const MappedFile &summary_valuations) {
+  if (!exec(db, "BEGIN;", "Begin") || !copy_schema(db, "table") ||
+      !exec(db, "COMMIT;", "Commit") || !exec_file(db, "tables.sql") ||
+      !exec(db, "BEGIN;", "Begin")) {
+    return false;
+  }
+  cout << "Loading list entries" << endl;
+  if (!load_list_entries(db, list_entries, nullptr)) {
+    return false;
+  }
+  cout << "Loading summary valuations" << endl;
+  if (!load_summary_valuations(db, summary_valuations, nullptr) ||
+      !exec(db, "COMMIT;", "Commit")) {
+    return false;
+  }
+  // views may depend on the loaded tables so come last
+  return exec_file(db, "indexes.sql") &&
+         exec_file(db, "current_assessments.sql") &&
+         exec_file(db, "list_entry_tokens.sql") &&
+         copy_schema(db, "index") && copy_schema(db, "trigger") &&
+         copy_schema(db, "view") && exec(db, "DETACH live;", "Detach");
+}
+
+static bool apply(sqlite3 *db, const MappedFile &list_entries,
+                  const MappedFile &summary_valuations) {
+  if (!exec(db, "BEGIN IMMEDIATE;", "Begin") ||
+      !exec(db,
+            "CREATE TEMP TABLE changed_uarns (uarn INTEGER PRIMARY KEY); "
+            "CREATE TEMP TABLE changed_list_entries "
+            "(uarn INTEGER PRIMARY KEY);",
+            "Creating change tables")) {
+    return false;
+  }
+  ChangeTracker changes(db);
+  if (!changes.ok()) {
+    return false;
+  }
+  cout << "Applying list entries changes" << endl;
+  if (!load_list_entries(db, list_entries, &changes)) {
+    return false;
+  }
+  cout << "Applying summary valuations changes" << endl;
+  return load_summary_valuations(db, summary_valuations, &changes) &&
+         exec_file(db, "apply_changes.sql") && exec(db, "COMMIT;", "Commit");
+}
+
+int main(int argc, char *argv[]) {
+  bool incremental = argc > 1 && strcmp(argv[1], "--apply") == 0;
+  int args = incremental ? 2 : 1;
+  if (argc < args + 3) {
+    cerr << "Usage: " << argv[0]
+         << " [--apply] <database> <list entries file> "
+            "<summary valuations file>"
+         << endl;
+    return 1;
+  }
+  MappedFile list_entries(argv[args + 1]), summary_valuations(argv[args + 2]);
+  if (!list_entries.ok() || !summary_valuations.ok()) {
+    cerr << "Couldn't read "
+         << (list_entries.ok() ? argv[args + 2] : argv[args + 1]) << endl;
+    return 1;
+  }
+  sqlite3 *db;
+  if (incremental) {
+    if (sqlite3_open(argv[args], &db) != SQLITE_OK) {
+      cerr << "Couldn't open database" << endl;
+      sqlite3_close(db);
+      return 1;
+    }
+    // wait on the server's writes rather than failing
+    sqlite3_busy_timeout(db, 30000);
+    bool ok = exec(db, "PRAGMA journal_mode = WAL;", "Setting pragmas") &&
+              apply(db, list_entries, summary_valuations);
+    if (sqlite3_get_autocommit(db) == 0) {
+      exec(db, "ROLLBACK;", "Rollback");
+    }
+    sqlite3_close(db);
+    cout << (ok ? "Applied" : "Apply failed, nothing changed") << endl;
+    return ok ? 0 : 1;
+  }
+
+  string loading = string(argv[args]) + ".loading";
+  // left by a load that was killed
+  remove(loading.c_str());
+  if (sqlite3_open(loading.c_str(), &db) != SQLITE_OK) {
+    cerr << "Couldn't create " << loading << endl;
+    sqlite3_close(db);
+    return 1;
+  }
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db, "ATTACH ? AS live;", -1, &stmt, NULL);
+  sqlite3_bind_text(stmt, 1, argv[args], -1, SQLITE_STATIC);
+  bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+  sqlite3_finalize(stmt);
+  if (!ok) {
+    cerr << "Couldn't open database: " << sqlite3_errmsg(db) << endl;
+  }
+
+  // put back whatever journal mode the server uses once loaded
+  string journal_mode = "DELETE";
+  sqlite3_prepare_v2(db, "PRAGMA live.journal_mode;", -1, &stmt, NULL);
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    journal_mode = (const char *)sqlite3_column_text(stmt, 0);
+  }
+  sqlite3_finalize(stmt);
+
+  ok = ok &&
+       exec(db,
+            "PRAGMA main.journal_mode = OFF; PRAGMA main.synchronous = OFF; "
+            "PRAGMA cache_size = -262144; PRAGMA temp_store = MEMORY;",
+            "Setting pragmas") &&
+       load(db, list_entries, summary_valuations) &&
+       exec(db, "PRAGMA journal_mode = " + journal_mode + ";",
+            "Setting journal mode");
+  sqlite3_close(db);
+
+  // a WAL left by the old database would be replayed
+  // into the new one, so it's taken out of WAL first
+  if (ok && journal_mode == "wal") {
+    ok = sqlite3_open(argv[args], &db) == SQLITE_OK &&
+         exec(db, "PRAGMA journal_mode = DELETE;",
+              "Closing the old database's WAL (is the server stopped?)");
+    sqlite3_close(db);
+  }
+  if (ok && rename(loading.c_str(), argv[args]) != 0) {
+    perror("Replacing the database");
+    ok = false;
+  }
+  if (!ok) {
+    remove(loading.c_str());
+  }
+  cout << (ok ? "Loaded" : "Load failed, nothing changed") << endl;
+  return ok ? 0 : 1;
+}
@@ -94,6 +94,28 @@ SELECT data
 FROM tiles_grid
 WHERE row = AND col = ;
 
+SELECT tile
+FROM combined_tiles
+WHERE neighbourhood = '21304,16350:21304,16350;';
+
+DELETE FROM combined_tiles
+WHERE neighbourhood IN (
+	SELECT neighbourhood
+	FROM combined_tile_members
+	WHERE row = 21304 AND col = 16351
+);
+
+-- Address lookup, one seek on idx_list_entries_postcode_street_number_or_name
+SELECT ca.assessment_reference, ca.scat_description_text, ca.primary_description_text,
+	   ca.composite_indicator, ca.rateable_value, ca.uarn
+FROM list_entries le
+  INNER JOIN current_assessments ca
+  ON le.uarn = ca.uarn
+WHERE le.postcode = 'SS8 7AE' AND le.street = 'FURTHERWICK ROAD' AND (
+  le.number_or_name = '52' OR le.number_or_name LIKE '% 52'
+  OR le.number_or_name LIKE '52 %' OR le.number_or_name LIKE '% 52 %'
+);
+
 --Debugging
 SELECT le.uarn, rle.assessment_reference
 FROM list_entries le
@@ -141,6 +141,28 @@ CREATE TABLE IF NOT EXISTS scat_codes (
 	description_text VARCHAR(120)
 );
 
+-- Each list entry's latest assessment with its scat description,
+-- rebuilt by current_assessments.sql after the lists are imported
+CREATE TABLE IF NOT EXISTS current_assessments (
+	uarn INTEGER PRIMARY KEY,
+	assessment_reference INTEGER,
+	number_or_name VARCHAR(72),
+	primary_description_text VARCHAR(60),
+	scat_description_text VARCHAR(120),
+	composite_indicator CHAR(1),
+	rateable_value NUMERIC
+);
+
+-- Every space separated word of each list entry's number_or_name,
+-- lowercased, rebuilt by list_entry_tokens.sql after the lists are imported
+CREATE TABLE IF NOT EXISTS list_entry_tokens (
+	postcode VARCHAR(8),
+	street VARCHAR(36),
+	token VARCHAR(72),
+	uarn INTEGER,
+	CONSTRAINT list_entry_tokens_pk PRIMARY KEY (postcode, street, token, uarn)
+) WITHOUT ROWID;
+
 
 
 
@@ -152,3 +174,18 @@ CREATE TABLE IF NOT EXISTS tiles_grid (
 	tile BLOB,
 	CONSTRAINT tiles_grid_row_col_pk PRIMARY KEY (row, col)
 );
+
+-- Neighbourhoods of tiles already combined around a centre tile
+CREATE TABLE IF NOT EXISTS combined_tiles (
+	neighbourhood TEXT PRIMARY KEY,
+	tile BLOB
+);
+
+-- Tiles each combined tile was made from
+CREATE TABLE IF NOT EXISTS combined_tile_members (
+	neighbourhood TEXT,
+	row INTEGER,
+	col INTEGER,
+	CONSTRAINT combined_tile_members_pk PRIMARY KEY (neighbourhood, row, col),
+	FOREIGN KEY (neighbourhood) REFERENCES combined_tiles(neighbourhood)
+) WITHOUT ROWID;
@@ -0,0 +1,153 @@
+#ifndef GUARD_VOA_RECORDS_H
+#define GUARD_VOA_RECORDS_H
+#include <cctype>
+#include <cstring>
+#include <fcntl.h>
+#include <initializer_list>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Reading the VOA's * delimited extracts, shared by
+ * format_valuations and load_valuations
+ */
+
+// The whole of a file mapped read only
+class MappedFile {
+public:
+  MappedFile(const char *path)
+      : data(nullptr), size(0), fd(open(path, O_RDONLY)) {
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+      return;
+    }
+    size = st.st_size;
+    if (size == 0) {
+      return;
+    }
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      size = 0;
+      return;
+    }
+    madvise(mapped, size, MADV_SEQUENTIAL);
+    data = (const char *)mapped;
+  }
+
+  MappedFile(const MappedFile &other) = delete;
+  MappedFile &operator=(const MappedFile &other) = delete;
+
+  ~MappedFile() {
+    if (data) {
+      munmap((void *)data, size);
+    }
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+
+  // empty files count as opened
+  bool ok() const { return fd != -1 && (data || size == 0); }
+
+  const char *begin() const { return data; }
+  const char *end() const { return data + size; }
+
+  size_t length() const { return size; }
+
+private:
+  const char *data;
+  size_t size;
+  int fd;
+};
+
+// Position of the first `c` in [first, last), or last
+static inline const char *find_char(const char *first, const char *last,
+                                    char c) {
+  const char *res = (const char *)memchr(first, c, last - first);
+  return res ? res : last;
+}
+
+/*
+ * Reads a record type the way stoi would, returns
+ * -1 when it doesn't start with a number
+ */
+static inline int record_type(const char *first, const char *last) {
+  while (first != last && isspace((unsigned char)*first)) {
+    first++;
+  }
+  bool negative = first != last && *first == '-';
+  if (first != last && (*first == '-' || *first == '+')) {
+    first++;
+  }
+  if (first == last || !isdigit((unsigned char)*first)) {
+    return -1;
+  }
+  int res = 0;
+  while (first != last && isdigit((unsigned char)*first) && res < 100) {
+    res = res * 10 + (*first++ - '0');
+  }
+  return negative ? -res : res;
+}
+
+// list entries' uarn
+static const int LIST_ENTRY_UARN_FIELD = 6;
+
+// 01 records' from date, in DD-MMM-YYYY
+static const int FROM_DATE_FIELD = 24;
+
+// Whether the record is an 01, which the records after it belong to
+static inline bool is_assessment(const char *first, const char *last) {
+  return last - first == 2 && first[0] == '0' && first[1] == '1';
+}
+
+/*
+ * Finds field `n`, counting from 0, of the record
+ * [first, last). Both ends are last if it's short.
+ */
+static inline void find_field(const char *first, const char *last, int n,
+                              const char *&field_beg, const char *&field_end) {
+  field_beg = first;
+  for (int i = 0; i != n && field_beg != last; i++) {
+    field_beg = find_char(field_beg, last, '*');
+    if (field_beg != last) {
+      field_beg++;
+    }
+  }
+  field_end = find_char(field_beg, last, '*');
+}
+
+/*
+ * Writes DD-MMM-YYYY as YYYY-MM-DD into `converted`,
+ * returns false if [first, last) isn't such a date
+ */
+static inline bool convert_to_sqlite_date(const char *first, const char *last,
+                                          char *converted) {
+  static const char *months[] = {"jan", "feb", "mar", "apr", "may", "jun",
+                                 "jul", "aug", "sep", "oct", "nov", "dec"};
+  if (last - first != 11 || first[2] != '-' || first[6] != '-') {
+    return false;
+  }
+  for (int i : {0, 1, 7, 8, 9, 10}) {
+    if (!isdigit((unsigned char)first[i])) {
+      return false;
+    }
+  }
+  int month = 0;
+  while (month != 12 && strncasecmp(first + 3, months[month], 3) != 0) {
+    month++;
+  }
+  if (month == 12) {
+    return false;
+  }
+  month++;
+  memcpy(converted, first + 7, 4);
+  converted[4] = '-';
+  converted[5] = '0' + month / 10;
+  converted[6] = '0' + month % 10;
+  converted[7] = '-';
+  memcpy(converted + 8, first, 2);
+  return true;
+}
+#endif
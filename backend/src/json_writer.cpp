@@ -0,0 +1,102 @@
+#include "../include/json_writer.h"
+#include <cmath>
+#include <cstdio>
+#include <nlohmann/json.hpp>
+
+/*
+ * Length of the UTF-8 character starting at `str`, 0 if
+ * it isn't valid. Rejects overlong forms, surrogates and
+ * anything past U+10FFFF like nlohmann does.
+ */
+static size_t utf8_char_len(const unsigned char *str, size_t len) {
+  size_t n;
+  unsigned char lo = 0x80, hi = 0xBF;
+  if (str[0] >= 0xC2 && str[0] <= 0xDF) {
+    n = 2;
+  } else if (str[0] >= 0xE0 && str[0] <= 0xEF) {
+    n = 3;
+    lo = str[0] == 0xE0 ? 0xA0 : 0x80;
+    hi = str[0] == 0xED ? 0x9F : 0xBF;
+  } else if (str[0] >= 0xF0 && str[0] <= 0xF4) {
+    n = 4;
+    lo = str[0] == 0xF0 ? 0x90 : 0x80;
+    hi = str[0] == 0xF4 ? 0x8F : 0xBF;
+  } else {
+    return 0;
+  }
+  if (len < n || str[1] < lo || str[1] > hi) {
+    return 0;
+  }
+  for (size_t i = 2; i != n; i++) {
+    if (str[i] < 0x80 || str[i] > 0xBF) {
+      return 0;
+    }
+  }
+  return n;
+}
+
+void JsonWriter::write_string(const char *str, size_t len) {
+  const unsigned char *ustr = (const unsigned char *)str;
+  char escaped[7];
+  size_t char_len;
+  buff += '"';
+  for (size_t i = 0; i != len;) {
+    unsigned char c = ustr[i];
+    if (c >= 0x80) {
+      char_len = utf8_char_len(ustr + i, len - i);
+      if (char_len == 0) {
+        buff += "\xEF\xBF\xBD";
+        i++;
+      } else {
+        buff.append(str + i, char_len);
+        i += char_len;
+      }
+      continue;
+    }
+    switch (c) {
+    case '"':
+      buff += "\\\"";
+      break;
+    case '\\':
+      buff += "\\\\";
+      break;
+    case '\b':
+      buff += "\\b";
+      break;
+    case '\f':
+      buff += "\\f";
+      break;
+    case '\n':
+      buff += "\\n";
+      break;
+    case '\r':
+      buff += "\\r";
+      break;
+    case '\t':
+      buff += "\\t";
+      break;
+    default:
+      if (c < 0x20) {
+        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        buff += escaped;
+      } else {
+        buff += c;
+      }
+    }
+    i++;
+  }
+  buff += '"';
+}
+
+void JsonWriter::value(double val) {
+  separate();
+  if (!std::isfinite(val)) {
+    buff += "null";
+  } else {
+    // nlohmann's shortest round trip formatting
+    char num[64];
+    char *end = nlohmann::detail::to_chars(num, num + sizeof(num), val);
+    buff.append(num, end);
+  }
+  need_comma = true;
+}
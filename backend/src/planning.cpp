@@ -14,55 +14,193 @@ std::string PlanningApplication::to_string() const {
   return res;
 }
 
-std::vector<PlanningApplication> fetch_planning_apps(CURL *handle, double lat,
-                                                     double lng, int radius) {
-  std::vector<PlanningApplication> applications;
-  float krad = radius / 1000.0;
-  std::string data;
-  char fields[] = "address,description,app_size,app_state,other_fields,start_"
-                  "date,location_x,location_y";
-  char url[500];
-  int index = 0;
-  nlohmann::json jdata;
-  double app_lat, app_lng;
-  float x, y;
-
-  do {
-    data.clear();
-    snprintf(
-        url, 500,
-        "%s?lat=%.9f&lng=%.9f&krad=%.3f&select=%s&sort=-start_date&index=%d",
-        config("PLANIT_URL").c_str(), lat, lng, krad, fields, index);
-    make_get_request(handle, url, data);
-    jdata = nlohmann::json::parse(data);
-
-    for (nlohmann::json &app : jdata["records"]) {
-      if (app["other_fields"].contains("northing") &&
-          app["other_fields"].contains("easting")) {
-        x = app["other_fields"]["easting"];
-        y = app["other_fields"]["northing"];
+void write_json(JsonWriter &writer, const PlanningApplication &plan_app) {
+  writer.start_object();
+  writer.field("address", plan_app.address);
+  writer.field("date_decision", plan_app.date_decision);
+  writer.field("date_decisison_issued", plan_app.date_decisison_issued);
+  writer.field("date_received", plan_app.date_received);
+  writer.field("date_validated", plan_app.date_validated);
+  writer.field("description", plan_app.description);
+  writer.key("location");
+  write_json(writer, plan_app.location);
+  writer.field("size", plan_app.size);
+  writer.field("state", plan_app.state);
+  writer.end_object();
+}
+
+/*
+ * Reads pages of PlanIt results into `applications`.
+ * Records without BNG coordinates are converted from
+ * lat/lng all at once after each page.
+ */
+class PlanItPageSax : public JsonPageSax {
+public:
+  PlanItPageSax(std::vector<PlanningApplication> &applications,
+                const NatGridTransform &nat_grid)
+      : applications(applications), nat_grid(nat_grid),
+        page({"to", "total"}),
+        record({"address", "description", "app_size", "app_state",
+                "location_x", "location_y"}),
+        other_fields({"easting", "northing", "date_received",
+                      "date_validated", "decision_date",
+                      "decision_issued_date"}) {}
+
+  int page_size() const { return page.number<int>(0) + 1; }
+
+  int total() const { return page.number<int>(1); }
+
+  // false if the page isn't valid JSON or its locations didn't convert
+  bool parse(const std::string &page_str) {
+    page_begin = applications.size();
+    lats.clear();
+    lngs.clear();
+    to_convert.clear();
+    bool res = JsonPageSax::parse(page_str);
+    return convert_locations() && res;
+  }
+
+private:
+  // indexes into `record` and `other_fields`
+  enum RecordField {
+    ADDRESS,
+    DESCRIPTION,
+    APP_SIZE,
+    APP_STATE,
+    LOCATION_X,
+    LOCATION_Y
+  };
+  enum OtherField {
+    EASTING,
+    NORTHING,
+    DATE_RECEIVED,
+    DATE_VALIDATED,
+    DECISION_DATE,
+    DECISION_ISSUED_DATE
+  };
+
+  JsonFields *fields_here() override {
+    if (inside({"records", ""})) {
+      return &record;
+    }
+    if (inside({"records", "", "other_fields"})) {
+      return &other_fields;
+    }
+    if (inside({})) {
+      return &page;
+    }
+    return nullptr;
+  }
+
+  void object_started() override {
+    if (at({"records", ""})) {
+      record.clear();
+      other_fields.clear();
+    }
+  }
+
+  void object_ended() override {
+    if (at({"records", ""})) {
+      add_application();
+    }
+  }
+
+  void add_application() {
+    float x = 0, y = 0;
+    if (other_fields.is_number(EASTING) && other_fields.is_number(NORTHING)) {
+      x = other_fields.number<float>(EASTING);
+      y = other_fields.number<float>(NORTHING);
+    } else {
+      to_convert.push_back(applications.size());
+      lats.push_back(record.number<double>(LOCATION_Y));
+      lngs.push_back(record.number<double>(LOCATION_X));
+    }
+    applications.push_back({record.string(ADDRESS),
+                            record.string(DESCRIPTION),
+                            record.string(APP_SIZE),
+                            record.string(APP_STATE),
+                            other_fields.string(DATE_RECEIVED),
+                            other_fields.string(DATE_VALIDATED),
+                            other_fields.string(DECISION_DATE),
+                            other_fields.string(DECISION_ISSUED_DATE),
+                            {x, y}});
+  }
+
+  // Fills in the page's lat/lng locations, dropping them if that fails
+  bool convert_locations() {
+    if (to_convert.empty()) {
+      return true;
+    }
+    std::vector<float> xs, ys;
+    if (global_to_nat_grid(nat_grid, lats, lngs, xs, ys)) {
+      for (int i = 0; i != to_convert.size(); i++) {
+        applications[to_convert[i]].location = {xs[i], ys[i]};
+      }
+      return true;
+    }
+    for (int i = 0; i != lats.size(); i++) {
+      std::cerr << "Failed to get BNG for (" << lats[i] << ", " << lngs[i]
+                << ")" << std::endl;
+    }
+    // keep the page's order without the unconverted ones
+    size_t kept = page_begin, next_drop = 0;
+    for (size_t i = page_begin; i != applications.size(); i++) {
+      if (next_drop != to_convert.size() && to_convert[next_drop] == i) {
+        next_drop++;
       } else {
-        app_lat = app["location_y"];
-        app_lng = app["location_x"];
-        if (!global_to_nat_grid(app_lat, app_lng, x, y)) {
-          std::cerr << "Failed to get BNG for (" << lat << ", " << lng << ")"
-                    << std::endl;
-          continue;
-        }
+        applications[kept++] = std::move(applications[i]);
       }
-      applications.push_back(
-          {std::move(app["address"]),
-           std::move(app["description"]),
-           get_json_field<std::string>(app, "app_size"),
-           get_json_field<std::string>(app, "app_state"),
-           get_json_field<std::string>(app["other_fields"], "date_received"),
-           get_json_field<std::string>(app["other_fields"], "date_validated"),
-           get_json_field<std::string>(app["other_fields"], "decision_date"),
-           get_json_field<std::string>(app["other_fields"],
-                                       "decision_issued_date"),
-           {x, y}});
     }
-    index = jdata["to"].get<int>() + 1;
-  } while (index < jdata["total"]);
+    applications.resize(kept);
+    return false;
+  }
+
+  std::vector<PlanningApplication> &applications;
+  const NatGridTransform &nat_grid;
+  JsonFields page, record, other_fields;
+  // where the page being parsed starts in `applications`
+  size_t page_begin;
+  // the page's applications needing their lat/lng converted
+  std::vector<size_t> to_convert;
+  std::vector<double> lats, lngs;
+};
+
+void get_planit_url(char *url_buff, size_t url_buff_sz, double lat, double lng,
+                    int radius, int index) {
+  float krad = radius / 1000.0;
+  snprintf(url_buff, url_buff_sz,
+           "%s?lat=%.9f&lng=%.9f&krad=%.3f&select=%s&sort=-start_date&index=%d",
+           config("PLANIT_URL").c_str(), lat, lng, krad,
+           "address,description,app_size,app_state,other_fields,start_date,"
+           "location_x,location_y",
+           index);
+}
+
+std::vector<PlanningApplication>
+fetch_planning_apps(MultiFetcher &fetcher, const NatGridTransform &nat_grid,
+                    double lat, double lng, int radius, bool &complete) {
+  std::vector<PlanningApplication> applications;
+  std::vector<std::string> urls, pages;
+  char url[500];
+  PlanItPageSax sax(applications, nat_grid);
+
+  // First page says how many more there are
+  get_planit_url(url, 500, lat, lng, radius, 0);
+  urls.push_back(url);
+  std::vector<bool> fetched = fetcher.get(urls, pages);
+  complete = fetched[0] && sax.parse(pages[0]);
+
+  // so the rest can be requested at once
+  int page_sz = sax.page_size();
+  int total = sax.total();
+  urls.clear();
+  for (int index = page_sz; page_sz > 0 && index < total; index += page_sz) {
+    get_planit_url(url, 500, lat, lng, radius, index);
+    urls.push_back(url);
+  }
+  fetched = fetcher.get(urls, pages);
+  for (int i = 0; i != pages.size(); i++) {
+    complete = fetched[i] && sax.parse(pages[i]) && complete;
+  }
   return applications;
 }
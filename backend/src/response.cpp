@@ -0,0 +1,148 @@
+#include "../include/response.h"
+#include "../include/json_writer.h"
+#include "../include/util.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Roughly how much of a response is written per chunk
+static const size_t RESPONSE_CHUNK_SIZE = 1 << 16;
+
+ResponseCache &response_cache() {
+  static ResponseCache cache(config_long("RESPONSE_CACHE_BYTES", 64 << 20),
+                             config_long("RESPONSE_CACHE_SHARDS", 16));
+  return cache;
+}
+
+std::chrono::seconds response_cache_ttl() {
+  static const std::chrono::seconds ttl(
+      config_long("RESPONSE_CACHE_TTL_S", 300));
+  return ttl;
+}
+
+std::string response_cache_key(float x, float y, int rad) {
+  static const float quantum = config_long("RESPONSE_CACHE_QUANTUM_M", 5);
+  if (quantum > 0) {
+    x = std::round(x / quantum) * quantum;
+    y = std::round(y / quantum) * quantum;
+  }
+  return get_location_key(x, y) + "," + std::to_string(rad);
+}
+
+std::string new_etag() {
+  static const long started =
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count();
+  static std::atomic<long> count(0);
+  char etag[50];
+  snprintf(etag, 50, "\"%lx-%lx\"", started, count++);
+  return etag;
+}
+
+bool etag_matches(const std::string &header, const std::string &etag) {
+  size_t beg = 0, end;
+  while (beg < header.size()) {
+    end = header.find(',', beg);
+    if (end == std::string::npos) {
+      end = header.size();
+    }
+    while (beg < end && header[beg] == ' ') {
+      beg++;
+    }
+    // weak comparison, so W/ makes no difference
+    if (header.compare(beg, 2, "W/") == 0) {
+      beg += 2;
+    }
+    size_t last = end;
+    while (last > beg && header[last - 1] == ' ') {
+      last--;
+    }
+    if (header.compare(beg, last - beg, etag) == 0 ||
+        header.compare(beg, last - beg, "*") == 0) {
+      return true;
+    }
+    beg = end + 1;
+  }
+  return false;
+}
+
+bool send_cached_response(const httplib::Request &req,
+                          httplib::Response &resp, const std::string &key) {
+  std::shared_ptr<const CachedResponse> cached = response_cache().get(key);
+  if (cached == nullptr) {
+    return false;
+  }
+  if (cached->expires <= std::chrono::steady_clock::now()) {
+    response_cache().erase(key);
+    return false;
+  }
+  resp.set_header("ETag", cached->etag);
+  if (req.has_header("If-None-Match") &&
+      etag_matches(req.get_header_value("If-None-Match"), cached->etag)) {
+    resp.status = httplib::StatusCode::NotModified_304;
+    return true;
+  }
+  // served from the cached string rather than a copy
+  resp.set_content_provider(
+      cached->body.size(), "application/json",
+      [cached](size_t offset, size_t length, httplib::DataSink &sink) {
+        return sink.write(cached->body.data() + offset, length);
+      });
+  return true;
+}
+
+void stream_buildings(httplib::Response &resp, std::vector<Building> &&res,
+                      const std::string &cache_key, bool complete) {
+  auto buildings = std::make_shared<std::vector<Building>>(std::move(res));
+  auto writer = std::make_shared<JsonWriter>();
+  auto next = std::make_shared<size_t>(0);
+  std::shared_ptr<CachedResponse> cached;
+  if (complete && response_cache_ttl().count() > 0) {
+    cached = std::make_shared<CachedResponse>();
+    // sent before the body so can't depend on it
+    cached->etag = new_etag();
+    resp.set_header("ETag", cached->etag);
+  }
+  resp.set_chunked_content_provider(
+      "application/json", [buildings, writer, next, cached, cache_key](
+                              size_t offset, httplib::DataSink &sink) {
+        writer->clear();
+        if (offset == 0) {
+          writer->start_object();
+          writer->key("results");
+          writer->start_array();
+        }
+        while (*next != buildings->size() &&
+               writer->size() < RESPONSE_CHUNK_SIZE) {
+          write_json(*writer, (*buildings)[(*next)++]);
+        }
+        bool last = *next == buildings->size();
+        if (last) {
+          writer->end_array();
+          writer->field("results_size", buildings->size());
+          writer->end_object();
+        }
+        if (cached) {
+          cached->body.append(writer->data(), writer->size());
+        }
+        if (!sink.write(writer->data(), writer->size())) {
+          return false;
+        }
+        if (last) {
+          // cached before the client can see the end and ask again
+          if (cached) {
+            cached->expires =
+                std::chrono::steady_clock::now() + response_cache_ttl();
+            response_cache().put(cache_key, cached,
+                                 cache_key.size() + cached->body.size());
+          }
+          sink.done();
+        }
+        return true;
+      });
+}
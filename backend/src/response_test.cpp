@@ -0,0 +1,126 @@
+#include "../include/building.h"
+#include "../include/httplib.h"
+#include "../include/response.h"
+#include "../include/util.h"
+#include <curl/curl.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const std::string HOST = "127.0.0.1";
+
+/*
+ * Stands in for an upstream API and for the /buildings
+ * endpoint, which fetches `upstream` and streams a single
+ * building, cached under `upstream` if the fetch worked
+ */
+class TestServer {
+public:
+  TestServer() {
+    server.Get("/ok", [](const httplib::Request &req,
+                         httplib::Response &resp) {
+      resp.set_content("{}", "application/json");
+    });
+    server.Get("/fail", [](const httplib::Request &req,
+                           httplib::Response &resp) {
+      resp.status = httplib::StatusCode::InternalServerError_500;
+    });
+    server.Get("/buildings", [this](const httplib::Request &req,
+                                    httplib::Response &resp) {
+      std::string key = req.get_param_value("upstream");
+      if (send_cached_response(req, resp, key)) {
+        return;
+      }
+      std::vector<std::string> pages;
+      std::vector<bool> fetched = fetcher.get({url(key)}, pages);
+      std::vector<Building> res(1);
+      res[0].name = key;
+      res[0].tob = TypeOfBuilding::RESIDENTIAL;
+      stream_buildings(resp, std::move(res), key, fetched[0]);
+    });
+    port = server.bind_to_any_port(HOST);
+    thread = std::thread([this] { server.listen_after_bind(); });
+    server.wait_until_ready();
+  }
+
+  ~TestServer() {
+    server.stop();
+    thread.join();
+  }
+
+  std::string url(const std::string &path) const {
+    return "http://" + HOST + ":" + std::to_string(port) + path;
+  }
+
+  int port;
+
+private:
+  httplib::Server server;
+  std::thread thread;
+  MultiFetcher fetcher;
+};
+
+void test_fetch_status(TestServer &server) {
+  MultiFetcher fetcher;
+  std::vector<std::string> pages;
+  std::vector<bool> fetched = fetcher.get(
+      {server.url("/ok"), server.url("/fail"), server.url("/missing")}, pages);
+  if (fetched != std::vector<bool>{true, false, false} || pages[0] != "{}") {
+    std::cout << "test_fetch_status(): FAILED" << std::endl;
+    return;
+  }
+  std::cout << "test_fetch_status(): PASSED" << std::endl;
+}
+
+void test_failed_fetch_not_cached(TestServer &server) {
+  httplib::Client client(HOST, server.port);
+  bool passed = true;
+  for (int i = 0; i != 2; i++) {
+    httplib::Result res = client.Get("/buildings?upstream=/fail");
+    // served each time, just never remembered
+    if (!res || res->status != 200 || res->has_header("ETag") ||
+        res->body.find("\"results_size\":1") == std::string::npos ||
+        response_cache().get("/fail") != nullptr) {
+      std::cout << "test_failed_fetch_not_cached(" << i << "): FAILED"
+                << std::endl;
+      passed = false;
+    }
+  }
+  if (passed) {
+    std::cout << "test_failed_fetch_not_cached(): PASSED" << std::endl;
+  }
+}
+
+void test_fetched_cached(TestServer &server) {
+  httplib::Client client(HOST, server.port);
+  httplib::Result res = client.Get("/buildings?upstream=/ok");
+  std::shared_ptr<const CachedResponse> cached = response_cache().get("/ok");
+  if (!res || !res->has_header("ETag") || cached == nullptr ||
+      cached->body != res->body ||
+      cached->etag != res->get_header_value("ETag")) {
+    std::cout << "test_fetched_cached(0): FAILED" << std::endl;
+    return;
+  }
+  res = client.Get("/buildings?upstream=/ok",
+                   {{"If-None-Match", cached->etag}});
+  if (!res || res->status != httplib::StatusCode::NotModified_304) {
+    std::cout << "test_fetched_cached(1): FAILED" << std::endl;
+    return;
+  }
+  std::cout << "test_fetched_cached(): PASSED" << std::endl;
+}
+
+int main() {
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  {
+    TestServer server;
+    test_fetch_status(server);
+    if (response_cache_ttl().count() > 0) {
+      test_failed_fetch_not_cached(server);
+      test_fetched_cached(server);
+    }
+  }
+  curl_global_cleanup();
+  return 0;
+}
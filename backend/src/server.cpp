@@ -1,20 +1,38 @@
 #include "../include/building.h"
 #include "../include/httplib.h"
+#include "../include/json_writer.h"
 #include "../include/planning.h"
+#include "../include/response.h"
+#include "../include/task_pool.h"
 #include "../include/util.h"
 #include "../include/valuation.h"
+#include "../include/valuation_snapshot.h"
+#include "../include/worker.h"
 #include <algorithm>
 #include <cfloat>
 #include <cstdio>
 #include <cstdlib>
 #include <float.h>
+#include <future>
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 using nlohmann::json;
 
+/*
+ * Threads the upstream stages of a request run on besides
+ * its worker, STAGE_THREADS of them, by default enough for
+ * every worker's two at once.
+ */
+static TaskPool &stage_pool() {
+  static TaskPool pool(config_long("STAGE_THREADS", 2 * worker_count()));
+  return pool;
+}
+
 // Buildings grouped by location
 typedef std::unordered_map<FPoint, std::vector<Building *>> BuildingGroups;
 
@@ -39,26 +57,30 @@ bool get_search_params(const httplib::Request &req, httplib::Response &resp,
 }
 
 template <class T>
-void translate_locations(CURL *handle, std::vector<T> &objs,
-                         const FPoint &centre) {
-  std::vector<FPoint *> locations;
+void add_locations(std::vector<T> &objs, std::vector<FPoint *> &locations) {
   std::transform(objs.begin(), objs.end(), std::back_inserter(locations),
                  [](T &o) { return &o.location; });
-  translate_points_to_building_centres(handle, locations, centre);
 }
 
 /*
  * Combines both `Building`s and `PlanningApplication`s streams
  * into a single result stream of `Building`s.
  * It also groups `Building`s together by location e.g. a block
- * of flats.
+ * of flats. `complete` is set false if some tiles couldn't be
+ * fetched, so some locations weren't grouped.
  */
 std::vector<Building>
-cluster_buildings(CURL *handle, std::vector<Building> &buildings,
+cluster_buildings(WorkerContext &ctx, std::vector<Building> &buildings,
                   std::vector<PlanningApplication> &plan_apps,
-                  const FPoint &centre) {
-  // translate building locations
-  translate_locations(handle, buildings, centre);
+                  const FPoint &centre, bool &complete) {
+  // translate building and planning application
+  // locations against the same combined tile
+  std::vector<FPoint *> locations;
+  add_locations(buildings, locations);
+  add_locations(plan_apps, locations);
+  complete = translate_points_to_building_centres(
+      ctx.tiles_fetcher, ctx.shapes_db, locations, centre);
+
   BuildingGroups building_groups;
   for (Building &b : buildings) {
     building_groups[b.location].push_back(&b);
@@ -74,9 +96,6 @@ cluster_buildings(CURL *handle, std::vector<Building> &buildings,
     loc_to_building[group.front()->location] = group.front();
   }
 
-  // translate planning application locations
-  translate_locations(handle, plan_apps, centre);
-
   // Group planning applications by address
   PlanAppGroups planapp_groups;
   for (PlanningApplication &plan_app : plan_apps) {
@@ -133,59 +152,120 @@ void building_endpoint(const httplib::Request &req, httplib::Response &resp) {
   if (!get_search_params(req, resp, lat, lng, rad)) {
     return;
   }
+  WorkerContext &ctx = worker_context();
   float x, y;
-  if (!global_to_nat_grid(lat, lng, x, y)) {
+  if (!global_to_nat_grid(ctx.nat_grid, lat, lng, x, y)) {
     char msg[100];
     snprintf(msg, 100, "Failed to get BND for (%f, %f)\n", lat, lng);
     resp.set_content(msg, "text/plain");
     resp.status = httplib::StatusCode::InternalServerError_500;
     return;
   }
-  CURL *handle = curl_easy_init();
-  if (!handle) {
+  std::string cache_key = response_cache_key(x, y, rad);
+  if (response_cache_ttl().count() > 0 &&
+      send_cached_response(req, resp, cache_key)) {
+    return;
+  }
+  if (!ctx.ready()) {
     resp.set_content("Failed to setup easy curl", "text/plain");
     resp.status = httplib::StatusCode::InternalServerError_500;
     return;
   }
-
-  // Get Buildings
-  std::vector<Building> buildings = fetch_buildings(handle, x, y, rad);
-  ValuationDB db;
-  if (!db.connected()) {
+  if (!ctx.valuations().ready() || !ctx.shapes_db.connected()) {
     resp.set_content("Failed to connect to db", "text/plain");
     resp.status = httplib::StatusCode::InternalServerError_500;
     return;
   }
-  std::vector<ValuationDB::QueryParam> params;
-  std::transform(buildings.begin(), buildings.end(), std::back_inserter(params),
-                 get_query_param);
-  std::vector<ValuationDB::QueryResult> valuation_results =
-      db.get_valuations(params);
-  for (int i = 0; i != buildings.size(); i++) {
-    buildings[i].valuations = std::move(valuation_results[i]);
-  }
+  FPoint centre = {x, y};
+
+  // The upstream stages only depend on the search params so
+  // run them concurrently, each on its own handle. Two go
+  // to `stage_pool()` while this thread does the third.
+
+  // Get Buildings and their valuations
+  std::future<std::pair<std::vector<Building>, bool>> buildings_fut =
+      stage_pool().submit([&ctx, x, y, rad] {
+        bool complete;
+        std::vector<Building> buildings =
+            fetch_buildings(ctx.places_fetcher, x, y, rad, complete);
+        std::vector<ValuationEngine::QueryParam> params;
+        std::transform(buildings.begin(), buildings.end(),
+                       std::back_inserter(params), get_query_param);
+        std::vector<ValuationEngine::QueryResult> valuation_results =
+            ctx.valuations().get_valuations(params);
+        for (int i = 0; i != buildings.size(); i++) {
+          buildings[i].valuations = std::move(valuation_results[i]);
+        }
+        return std::make_pair(std::move(buildings), complete);
+      });
 
   // Get PlanningApplications
-  std::vector<PlanningApplication> plan_apps =
-      fetch_planning_apps(handle, lat, lng, rad);
-  curl_easy_cleanup(handle);
+  std::future<std::pair<std::vector<PlanningApplication>, bool>>
+      plan_apps_fut = stage_pool().submit([&ctx, lat, lng, rad] {
+        bool complete;
+        std::vector<PlanningApplication> plan_apps = fetch_planning_apps(
+            ctx.planit_fetcher, ctx.nat_grid, lat, lng, rad, complete);
+        return std::make_pair(std::move(plan_apps), complete);
+      });
+
+  // Get the tiles the results will be clustered against,
+  // so only results outside the search need tiles later
+  bool complete = fetch_tiles(ctx.tiles_fetcher, ctx.shapes_db,
+                              get_search_grid_positions(centre, rad));
+
+  auto [buildings, buildings_complete] = buildings_fut.get();
+  auto [plan_apps, plan_apps_complete] = plan_apps_fut.get();
+  // anything missing isn't cached so the next request retries it
+  complete = complete && buildings_complete && plan_apps_complete;
 
   // Combine both streams into result
-  FPoint centre = {x, y};
+  bool clustered;
   std::vector<Building> res =
-      cluster_buildings(handle, buildings, plan_apps, centre);
+      cluster_buildings(ctx, buildings, plan_apps, centre, clustered);
+  complete = complete && clustered;
 
-  json resp_json = {{"results_size", res.size()}, {"results", res}};
+  stream_buildings(resp, std::move(res), cache_key, complete);
+}
+
+template <class Cache> json cache_stats(Cache &cache) {
+  typename Cache::Stats stats = cache.stats();
+  return {{"hits", stats.hits},
+          {"misses", stats.misses},
+          {"evictions", stats.evictions},
+          {"entries", stats.entries},
+          {"bytes", stats.bytes}};
+}
+
+void stats_endpoint(const httplib::Request &req, httplib::Response &resp) {
+  json resp_json = {
+      {"tile_cache", cache_stats(tile_cache())},
+      {"combined_tile_cache", cache_stats(combined_tile_cache())},
+      {"response_cache", cache_stats(response_cache())}};
   resp.set_content(resp_json.dump(), "application/json");
 }
 
 int main(int argc, char *argv[]) {
+  // Must happen before any worker creates its curl handle
+  curl_global_init(CURL_GLOBAL_DEFAULT);
   httplib::Server server;
   std::string url = config("SERVER_URL");
   int port = atoi(config("SERVER_PORT").c_str());
+  size_t workers = worker_count();
+  server.new_task_queue = [workers] {
+    return new httplib::ThreadPool(workers);
+  };
+
+  if (use_valuation_snapshot()) {
+    // loaded up front so the first request doesn't wait on it
+    std::cout << "Loaded " << valuation_snapshot().size()
+              << " valuations into memory" << std::endl;
+  }
 
   server.Get("/buildings", building_endpoint);
-  std::cout << "Starting server on " << url << ":" << port << std::endl;
+  server.Get("/stats", stats_endpoint);
+  std::cout << "Starting server on " << url << ":" << port << " with "
+            << workers << " workers" << std::endl;
   server.listen(url, port);
+  curl_global_cleanup();
   return 0;
 }
@@ -0,0 +1,236 @@
+#include "../../include/building_shape.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace vector_tile;
+using BuildingShape = Tile_BuildingShape;
+using Clock = std::chrono::steady_clock;
+
+static const int BENCH_SEED = 42;
+
+void add_edge(BuildingShape &shape, int x1, int y1, int x2, int y2) {
+  shape.add_edges(x1);
+  shape.add_edges(y1);
+  shape.add_edges(x2);
+  shape.add_edges(y2);
+}
+
+/*
+ * Rectangle at (`x`,`y`) whose top edge is
+ * a staircase of `nsteps` steps, so shapes
+ * have a realistic number of edges.
+ */
+void add_building(Tile &tile, int x, int y, int w, int h, int nsteps) {
+  BuildingShape &shape = *tile.add_shapes();
+  shape.set_osid(std::to_string(tile.shapes_size()));
+  int step_w = w / nsteps;
+  int cx = x, cy = y;
+  for (int i = 0; i != nsteps; i++) {
+    int next_y = y + (i % 2);
+    if (next_y != cy) {
+      add_edge(shape, cx, cy, cx, next_y);
+      cy = next_y;
+    }
+    add_edge(shape, cx, cy, cx + step_w, cy);
+    cx += step_w;
+  }
+  add_edge(shape, cx, cy, cx, y + h);
+  add_edge(shape, cx, y + h, x, y + h);
+  add_edge(shape, x, y + h, x, y);
+  shape.add_approx_centre(x + w / 2);
+  shape.add_approx_centre(y + h / 2);
+}
+
+/*
+ * `ntiles` x `ntiles` combined tile packed
+ * with buildings, like the centre of a city.
+ */
+Tile make_city_tile(int ntiles, int size = 20, int nsteps = 5) {
+  Tile tile;
+  int extent = ntiles * 512;
+  int spacing = size + size / 5;
+  for (int y = 0; y + size < extent; y += spacing) {
+    for (int x = 0; x + size < extent; x += spacing) {
+      add_building(tile, x, y, size, size, nsteps);
+    }
+  }
+  return tile;
+}
+
+std::vector<Point> random_points(int n, int extent) {
+  std::vector<Point> res;
+  for (int i = 0; i != n; i++) {
+    res.push_back({rand() % extent, rand() % extent});
+  }
+  return res;
+}
+
+// Linear scan over every shape
+void scan_translate_point(Point &p, const ShapeStore &store) {
+  for (int i = 0; i != store.size(); i++) {
+    if (get_enclosure_type(p, store, i) == EnclosureType::INSIDE) {
+      p = store.centres[i];
+      return;
+    }
+  }
+}
+
+// Tests every edge midpoint against every part
+void scan_combine_building_shapes(const ShapeStore &store,
+                                  const std::vector<int> &shapes,
+                                  BuildingShape &res) {
+  std::vector<int> starts;
+  for (int shape : shapes) {
+    store.edge_starts(shape, starts);
+    for (int v : starts) {
+      Point mid = midpoint(store.xs[v], store.ys[v], store.xs[v + 1],
+                           store.ys[v + 1]);
+      bool is_boundry_edge = true;
+      for (int other : shapes) {
+        if (get_enclosure_type(mid, store, other) == EnclosureType::INSIDE) {
+          is_boundry_edge = false;
+        }
+      }
+      if (is_boundry_edge) {
+        add_edge(res, store.xs[v], store.ys[v], store.xs[v + 1],
+                 store.ys[v + 1]);
+      }
+    }
+  }
+}
+
+double elapsed_ms(Clock::time_point since) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - since)
+      .count();
+}
+
+void bench_shape_index(int ntiles, int npoints) {
+  Tile tile = make_city_tile(ntiles);
+  ShapeStore store(tile);
+  std::vector<Point> scanned = random_points(npoints, ntiles * 512);
+  std::vector<Point> indexed(scanned);
+
+  Clock::time_point start = Clock::now();
+  for (Point &p : scanned) {
+    scan_translate_point(p, store);
+  }
+  double scan_ms = elapsed_ms(start);
+
+  start = Clock::now();
+  ShapeIndex index(store.bboxes);
+  for (Point &p : indexed) {
+    translate_point_to_building_centre(p, store, index);
+  }
+  double index_ms = elapsed_ms(start);
+
+  bool same = std::equal(scanned.begin(), scanned.end(), indexed.begin());
+  std::cout << "bench_shape_index(" << ntiles << "x" << ntiles << " tiles, "
+            << tile.shapes_size() << " shapes, " << npoints
+            << " points): scan=" << scan_ms << "ms index=" << index_ms
+            << "ms speedup=" << scan_ms / index_ms << "x"
+            << (same ? "" : " RESULTS DIFFER") << std::endl;
+}
+
+/*
+ * `npoints` packed into a `spread` x `spread` area, like
+ * the addresses of a dense postcode, against buildings
+ * `size` wide with `nsteps` steps. Each lookup is run
+ * `nrepeat` times as single runs are too quick to time.
+ */
+void bench_batch_translate(int npoints, int spread, int size, int nsteps,
+                           int nrepeat = 50) {
+  Tile tile = make_city_tile(/*ntiles=*/3, size, nsteps);
+  ShapeStore store(tile);
+  ShapeIndex index(store.bboxes);
+  std::vector<Point> points = random_points(npoints, spread);
+  std::vector<Point> single, batched;
+
+  Clock::time_point start = Clock::now();
+  for (int r = 0; r != nrepeat; r++) {
+    single = points;
+    for (Point &p : single) {
+      translate_point_to_building_centre(p, store, index);
+    }
+  }
+  double single_ms = elapsed_ms(start) / nrepeat;
+
+  start = Clock::now();
+  std::vector<int> enclosing;
+  for (int r = 0; r != nrepeat; r++) {
+    batched = points;
+    get_enclosing_shapes(batched, store, index, enclosing);
+    for (int i = 0; i != npoints; i++) {
+      if (enclosing[i] != -1) {
+        batched[i] = store.centres[enclosing[i]];
+      }
+    }
+  }
+  double batch_ms = elapsed_ms(start) / nrepeat;
+
+  int nedge = store.xs.size() - (store.ring_offsets.size() - 1);
+  bool same = std::equal(single.begin(), single.end(), batched.begin());
+  std::cout << "bench_batch_translate(" << npoints << " points in " << spread
+            << "x" << spread << ", " << nedge / store.size()
+            << " edges per shape): single=" << single_ms
+            << "ms batch=" << batch_ms << "ms speedup=" << single_ms / batch_ms
+            << "x" << (same ? "" : " RESULTS DIFFER") << std::endl;
+}
+
+/*
+ * A building like a station or shopping centre split
+ * into four parts by the borders of the tiles around
+ * it. The parts overlap by a few cells across each
+ * border and have `nsteps` steps along their bottom.
+ */
+void bench_combine_split_building(int nsteps) {
+  Tile tile;
+  int overlap = 4, size = 512 + overlap;
+  for (int y : {0, 512 - overlap}) {
+    for (int x : {0, 512 - overlap}) {
+      add_building(tile, x, y, size, size, nsteps);
+    }
+  }
+  ShapeStore store(tile);
+  std::vector<int> parts = {0, 1, 2, 3};
+
+  BuildingShape scanned, combined;
+  Clock::time_point start = Clock::now();
+  scan_combine_building_shapes(store, parts, scanned);
+  double scan_ms = elapsed_ms(start);
+
+  start = Clock::now();
+  combine_building_shapes(store, parts, combined);
+  double combine_ms = elapsed_ms(start);
+
+  bool same = std::equal(scanned.edges().begin(), scanned.edges().end(),
+                         combined.edges().begin(), combined.edges().end());
+  std::cout << "bench_combine_split_building("
+            << store.xs.size() - (store.ring_offsets.size() - 1)
+            << " edges, " << combined.edges_size() / 4
+            << " kept): scan=" << scan_ms << "ms combine=" << combine_ms
+            << "ms speedup=" << scan_ms / combine_ms << "x"
+            << (same ? "" : " RESULTS DIFFER") << std::endl;
+}
+
+int main() {
+  srand(BENCH_SEED);
+  bench_shape_index(/*ntiles=*/1, /*npoints=*/100);
+  bench_shape_index(/*ntiles=*/3, /*npoints=*/500);
+  bench_shape_index(/*ntiles=*/5, /*npoints=*/2000);
+  bench_batch_translate(/*npoints=*/500, /*spread=*/200, /*size=*/20,
+                        /*nsteps=*/5);
+  bench_batch_translate(/*npoints=*/500, /*spread=*/200, /*size=*/100,
+                        /*nsteps=*/40);
+  bench_batch_translate(/*npoints=*/500, /*spread=*/200, /*size=*/140,
+                        /*nsteps=*/70);
+  bench_batch_translate(/*npoints=*/500, /*spread=*/200, /*size=*/200,
+                        /*nsteps=*/100);
+  bench_batch_translate(/*npoints=*/5000, /*spread=*/200, /*size=*/200,
+                        /*nsteps=*/100);
+  bench_combine_split_building(/*nsteps=*/100);
+  bench_combine_split_building(/*nsteps=*/500);
+  return 0;
+}
@@ -109,7 +109,10 @@ Tile_BuildingShape::Tile_BuildingShape(::_pbi::ConstantInitialized)
     : _impl_{/*decltype(_impl_._has_bits_)*/ {},
              /*decltype(_impl_._cached_size_)*/ {},
              /*decltype(_impl_.approx_centre_)*/ {},
-             /*decltype(_impl_.edges_)*/ {}, /*decltype(_impl_.osid_)*/
+             /*decltype(_impl_.edges_)*/ {},
+             /*decltype(_impl_.penalties_)*/ {},
+             /*decltype(_impl_._penalties_cached_byte_size_)*/ {0},
+             /*decltype(_impl_.osid_)*/
              {&::_pbi::fixed_address_empty_string,
               ::_pbi::ConstantInitialized{}}} {}
 struct Tile_BuildingShapeDefaultTypeInternal {
@@ -125,6 +128,8 @@ PROTOBUF_ATTRIBUTE_NO_DESTROY PROTOBUF_CONSTINIT
         _Tile_BuildingShape_default_instance_;
 PROTOBUF_CONSTEXPR Tile::Tile(::_pbi::ConstantInitialized)
     : _impl_{/*decltype(_impl_.shapes_)*/ {},
+             /*decltype(_impl_.interior_shapes_)*/ {},
+             /*decltype(_impl_._interior_shapes_cached_byte_size_)*/ {0},
              /*decltype(_impl_._cached_size_)*/ {}} {}
 struct TileDefaultTypeInternal {
   PROTOBUF_CONSTEXPR TileDefaultTypeInternal()
@@ -231,9 +236,12 @@ const uint32_t
         PROTOBUF_FIELD_OFFSET(::vector_tile::Tile_BuildingShape,
                               _impl_.approx_centre_),
         PROTOBUF_FIELD_OFFSET(::vector_tile::Tile_BuildingShape, _impl_.edges_),
+        PROTOBUF_FIELD_OFFSET(::vector_tile::Tile_BuildingShape,
+                              _impl_.penalties_),
         0,
         ~0u,
         ~0u,
+        ~0u,
         ~0u, // no _has_bits_
         PROTOBUF_FIELD_OFFSET(::vector_tile::Tile, _internal_metadata_),
         ~0u, // no _extensions_
@@ -241,6 +249,7 @@ const uint32_t
         ~0u, // no _weak_field_map_
         ~0u, // no _inlined_string_donated_
         PROTOBUF_FIELD_OFFSET(::vector_tile::Tile, _impl_.shapes_),
+        PROTOBUF_FIELD_OFFSET(::vector_tile::Tile, _impl_.interior_shapes_),
 };
 static const ::_pbi::MigrationSchema
     schemas[] PROTOBUF_SECTION_VARIABLE(protodesc_cold) = {
@@ -248,8 +257,8 @@ static const ::_pbi::MigrationSchema
         {20, 30, -1, sizeof(::vector_tile::FullTile_Feature)},
         {34, 46, -1, sizeof(::vector_tile::FullTile_Layer)},
         {52, -1, -1, sizeof(::vector_tile::FullTile)},
-        {59, 68, -1, sizeof(::vector_tile::Tile_BuildingShape)},
-        {71, -1, -1, sizeof(::vector_tile::Tile)},
+        {59, 69, -1, sizeof(::vector_tile::Tile_BuildingShape)},
+        {73, -1, -1, sizeof(::vector_tile::Tile)},
 };
 
 static const ::_pb::Message *const file_default_instances[] = {
@@ -293,16 +302,18 @@ const char
         "\?\n\010GeomType\022\013\n\007UNKNOWN\020\000\022\t\n\005POINT\020\001"
         "\022\016\n\nL"
         "INESTRING\020\002\022\013\n\007POLYGON\020\003*\005\010\020\020\200@"
-        "\"|\n\004Tile\022"
-        "/\n\006shapes\030\001 \003(\0132\037.vector_tile.Tile.Build"
-        "ingShape\032C\n\rBuildingShape\022\014\n\004osid\030\001 \002(\t\022"
-        "\025\n\rapprox_centre\030\002 \003(\005\022\r\n\005edges\030\003 "
-        "\003(\005";
+        "\"\260\001\n\004Tile"
+        "\022/\n\006shapes\030\001 \003(\0132\037.vector_tile.Tile.Buil"
+        "dingShape\022\033\n\017interior_shapes\030\002 \003(\005B\002\020\001"
+        "\032Z\n\rBuildingShape\022\014\n\004osid\030\001 \002(\t"
+        "\022\025\n\rapprox_centre\030\002 \003(\005\022\r\n\005edges\030\003 "
+        "\003(\005\022\025"
+        "\n\tpenalties\030\004 \003(\005B\002\020\001";
 static ::_pbi::once_flag descriptor_table_vector_5ftile_2eproto_once;
 const ::_pbi::DescriptorTable descriptor_table_vector_5ftile_2eproto = {
     false,
     false,
-    757,
+    810,
     descriptor_table_protodef_vector_5ftile_2eproto,
     "vector_tile.proto",
     &descriptor_table_vector_5ftile_2eproto_once,
@@ -1877,7 +1888,10 @@ Tile_BuildingShape::Tile_BuildingShape(const Tile_BuildingShape &from)
       decltype(_impl_._has_bits_){from._impl_._has_bits_},
       /*decltype(_impl_._cached_size_)*/ {},
       decltype(_impl_.approx_centre_){from._impl_.approx_centre_},
-      decltype(_impl_.edges_){from._impl_.edges_}, decltype(_impl_.osid_){}};
+      decltype(_impl_.edges_){from._impl_.edges_},
+      decltype(_impl_.penalties_){from._impl_.penalties_},
+      /*decltype(_impl_._penalties_cached_byte_size_)*/ {0},
+      decltype(_impl_.osid_){}};
 
   _internal_metadata_.MergeFrom<::PROTOBUF_NAMESPACE_ID::UnknownFieldSet>(
       from._internal_metadata_);
@@ -1899,7 +1913,10 @@ inline void Tile_BuildingShape::SharedCtor(::_pb::Arena *arena,
   new (&_impl_) Impl_{decltype(_impl_._has_bits_){},
                       /*decltype(_impl_._cached_size_)*/ {},
                       decltype(_impl_.approx_centre_){arena},
-                      decltype(_impl_.edges_){arena}, decltype(_impl_.osid_){}};
+                      decltype(_impl_.edges_){arena},
+                      decltype(_impl_.penalties_){arena},
+                      /*decltype(_impl_._penalties_cached_byte_size_)*/ {0},
+                      decltype(_impl_.osid_){}};
   _impl_.osid_.InitDefault();
 #ifdef PROTOBUF_FORCE_COPY_DEFAULT_STRING
   _impl_.osid_.Set("", GetArenaForAllocation());
@@ -1921,6 +1938,7 @@ inline void Tile_BuildingShape::SharedDtor() {
   GOOGLE_DCHECK(GetArenaForAllocation() == nullptr);
   _impl_.approx_centre_.~RepeatedField();
   _impl_.edges_.~RepeatedField();
+  _impl_.penalties_.~RepeatedField();
   _impl_.osid_.Destroy();
 }
 
@@ -1936,6 +1954,7 @@ void Tile_BuildingShape::Clear() {
 
   _impl_.approx_centre_.Clear();
   _impl_.edges_.Clear();
+  _impl_.penalties_.Clear();
   cached_has_bits = _impl_._has_bits_[0];
   if (cached_has_bits & 0x00000001u) {
     _impl_.osid_.ClearNonDefaultToEmpty();
@@ -2004,6 +2023,19 @@ const char *Tile_BuildingShape::_InternalParse(const char *ptr,
       } else
         goto handle_unusual;
       continue;
+    // repeated int32 penalties = 4 [packed = true];
+    case 4:
+      if (PROTOBUF_PREDICT_TRUE(static_cast<uint8_t>(tag) == 34)) {
+        ptr = ::PROTOBUF_NAMESPACE_ID::internal::PackedInt32Parser(
+            _internal_mutable_penalties(), ptr, ctx);
+        CHK_(ptr);
+      } else if (static_cast<uint8_t>(tag) == 32) {
+        _internal_add_penalties(
+            ::PROTOBUF_NAMESPACE_ID::internal::ReadVarint32(&ptr));
+        CHK_(ptr);
+      } else
+        goto handle_unusual;
+      continue;
     default:
       goto handle_unusual;
     } // switch
@@ -2061,6 +2093,16 @@ uint8_t *Tile_BuildingShape::_InternalSerialize(
         3, this->_internal_edges(i), target);
   }
 
+  // repeated int32 penalties = 4 [packed = true];
+  {
+    int byte_size =
+        _impl_._penalties_cached_byte_size_.load(std::memory_order_relaxed);
+    if (byte_size > 0) {
+      target =
+          stream->WriteInt32Packed(4, _internal_penalties(), byte_size, target);
+    }
+  }
+
   if (PROTOBUF_PREDICT_FALSE(_internal_metadata_.have_unknown_fields())) {
     target = ::_pbi::WireFormat::InternalSerializeUnknownFieldsToArray(
         _internal_metadata_
@@ -2101,6 +2143,20 @@ size_t Tile_BuildingShape::ByteSizeLong() const {
     total_size += data_size;
   }
 
+  // repeated int32 penalties = 4 [packed = true];
+  {
+    size_t data_size =
+        ::_pbi::WireFormatLite::Int32Size(this->_impl_.penalties_);
+    if (data_size > 0) {
+      total_size += 1 + ::_pbi::WireFormatLite::Int32Size(
+                            static_cast<int32_t>(data_size));
+    }
+    int cached_size = ::_pbi::ToCachedSize(data_size);
+    _impl_._penalties_cached_byte_size_.store(cached_size,
+                                              std::memory_order_relaxed);
+    total_size += data_size;
+  }
+
   return MaybeComputeUnknownFieldsSize(total_size, &_impl_._cached_size_);
 }
 
@@ -2125,6 +2181,7 @@ void Tile_BuildingShape::MergeImpl(
 
   _this->_impl_.approx_centre_.MergeFrom(from._impl_.approx_centre_);
   _this->_impl_.edges_.MergeFrom(from._impl_.edges_);
+  _this->_impl_.penalties_.MergeFrom(from._impl_.penalties_);
   if (from._internal_has_osid()) {
     _this->_internal_set_osid(from._internal_osid());
   }
@@ -2155,6 +2212,7 @@ void Tile_BuildingShape::InternalSwap(Tile_BuildingShape *other) {
   swap(_impl_._has_bits_[0], other->_impl_._has_bits_[0]);
   _impl_.approx_centre_.InternalSwap(&other->_impl_.approx_centre_);
   _impl_.edges_.InternalSwap(&other->_impl_.edges_);
+  _impl_.penalties_.InternalSwap(&other->_impl_.penalties_);
   ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::InternalSwap(
       &_impl_.osid_, lhs_arena, &other->_impl_.osid_, rhs_arena);
 }
@@ -2180,8 +2238,11 @@ Tile::Tile(::PROTOBUF_NAMESPACE_ID::Arena *arena, bool is_message_owned)
 Tile::Tile(const Tile &from) : ::PROTOBUF_NAMESPACE_ID::Message() {
   Tile *const _this = this;
   (void)_this;
-  new (&_impl_) Impl_{decltype(_impl_.shapes_){from._impl_.shapes_},
-                      /*decltype(_impl_._cached_size_)*/ {}};
+  new (&_impl_) Impl_{
+      decltype(_impl_.shapes_){from._impl_.shapes_},
+      decltype(_impl_.interior_shapes_){from._impl_.interior_shapes_},
+      /*decltype(_impl_._interior_shapes_cached_byte_size_)*/ {0},
+      /*decltype(_impl_._cached_size_)*/ {}};
 
   _internal_metadata_.MergeFrom<::PROTOBUF_NAMESPACE_ID::UnknownFieldSet>(
       from._internal_metadata_);
@@ -2191,8 +2252,11 @@ Tile::Tile(const Tile &from) : ::PROTOBUF_NAMESPACE_ID::Message() {
 inline void Tile::SharedCtor(::_pb::Arena *arena, bool is_message_owned) {
   (void)arena;
   (void)is_message_owned;
-  new (&_impl_) Impl_{decltype(_impl_.shapes_){arena},
-                      /*decltype(_impl_._cached_size_)*/ {}};
+  new (&_impl_) Impl_{
+      decltype(_impl_.shapes_){arena},
+      decltype(_impl_.interior_shapes_){arena},
+      /*decltype(_impl_._interior_shapes_cached_byte_size_)*/ {0},
+      /*decltype(_impl_._cached_size_)*/ {}};
 }
 
 Tile::~Tile() {
@@ -2209,6 +2273,7 @@ Tile::~Tile() {
 inline void Tile::SharedDtor() {
   GOOGLE_DCHECK(GetArenaForAllocation() == nullptr);
   _impl_.shapes_.~RepeatedPtrField();
+  _impl_.interior_shapes_.~RepeatedField();
 }
 
 void Tile::SetCachedSize(int size) const { _impl_._cached_size_.Set(size); }
@@ -2220,6 +2285,7 @@ void Tile::Clear() {
   (void)cached_has_bits;
 
   _impl_.shapes_.Clear();
+  _impl_.interior_shapes_.Clear();
   _internal_metadata_.Clear<::PROTOBUF_NAMESPACE_ID::UnknownFieldSet>();
 }
 
@@ -2245,6 +2311,19 @@ const char *Tile::_InternalParse(const char *ptr, ::_pbi::ParseContext *ctx) {
       } else
         goto handle_unusual;
       continue;
+    // repeated int32 interior_shapes = 2 [packed = true];
+    case 2:
+      if (PROTOBUF_PREDICT_TRUE(static_cast<uint8_t>(tag) == 18)) {
+        ptr = ::PROTOBUF_NAMESPACE_ID::internal::PackedInt32Parser(
+            _internal_mutable_interior_shapes(), ptr, ctx);
+        CHK_(ptr);
+      } else if (static_cast<uint8_t>(tag) == 16) {
+        _internal_add_interior_shapes(
+            ::PROTOBUF_NAMESPACE_ID::internal::ReadVarint32(&ptr));
+        CHK_(ptr);
+      } else
+        goto handle_unusual;
+      continue;
     default:
       goto handle_unusual;
     } // switch
@@ -2285,6 +2364,16 @@ uint8_t *Tile::_InternalSerialize(
             1, repfield, repfield.GetCachedSize(), target, stream);
   }
 
+  // repeated int32 interior_shapes = 2 [packed = true];
+  {
+    int byte_size = _impl_._interior_shapes_cached_byte_size_.load(
+        std::memory_order_relaxed);
+    if (byte_size > 0) {
+      target = stream->WriteInt32Packed(2, _internal_interior_shapes(),
+                                        byte_size, target);
+    }
+  }
+
   if (PROTOBUF_PREDICT_FALSE(_internal_metadata_.have_unknown_fields())) {
     target = ::_pbi::WireFormat::InternalSerializeUnknownFieldsToArray(
         _internal_metadata_
@@ -2311,6 +2400,20 @@ size_t Tile::ByteSizeLong() const {
         ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::MessageSize(msg);
   }
 
+  // repeated int32 interior_shapes = 2 [packed = true];
+  {
+    size_t data_size =
+        ::_pbi::WireFormatLite::Int32Size(this->_impl_.interior_shapes_);
+    if (data_size > 0) {
+      total_size += 1 + ::_pbi::WireFormatLite::Int32Size(
+                            static_cast<int32_t>(data_size));
+    }
+    int cached_size = ::_pbi::ToCachedSize(data_size);
+    _impl_._interior_shapes_cached_byte_size_.store(cached_size,
+                                                    std::memory_order_relaxed);
+    total_size += data_size;
+  }
+
   return MaybeComputeUnknownFieldsSize(total_size, &_impl_._cached_size_);
 }
 
@@ -2330,6 +2433,7 @@ void Tile::MergeImpl(::PROTOBUF_NAMESPACE_ID::Message &to_msg,
   (void)cached_has_bits;
 
   _this->_impl_.shapes_.MergeFrom(from._impl_.shapes_);
+  _this->_impl_.interior_shapes_.MergeFrom(from._impl_.interior_shapes_);
   _this->_internal_metadata_
       .MergeFrom<::PROTOBUF_NAMESPACE_ID::UnknownFieldSet>(
           from._internal_metadata_);
@@ -2353,6 +2457,7 @@ void Tile::InternalSwap(Tile *other) {
   using std::swap;
   _internal_metadata_.InternalSwap(&other->_internal_metadata_);
   _impl_.shapes_.InternalSwap(&other->_impl_.shapes_);
+  _impl_.interior_shapes_.InternalSwap(&other->_impl_.interior_shapes_);
 }
 
 ::PROTOBUF_NAMESPACE_ID::Metadata Tile::GetMetadata() const {
@@ -4,6 +4,7 @@
 #include <curl/curl.h>
 #include <fstream>
 #include <iterator>
+#include <memory>
 #include <string>
 #include <utility>
 
@@ -27,7 +28,8 @@ static const std::string PLANNING_TEST_TILE_PATH =
 static const std::string PLANNING_TEST_OUT_PATH =
     "src/tiles/extra/planning_test_out.csv";
 
-static CURL *CURL_HANDLE = curl_easy_init();
+static MultiFetcher FETCHER;
+static BuildingShapesDB SHAPES_DB;
 
 void test_edges_to_string() {
   BuildingShape building;
@@ -100,17 +102,17 @@ void test_translate_multiple_points(const std::string &bng_inp_path,
       set.insert(gp);
     }
   }
-  Tile tile = get_combined_tile(CURL_HANDLE, grid_positions,
-                                cc.get_centre_row(), cc.get_centre_col());
+  std::shared_ptr<const CombinedTile> combined = get_combined_tile(
+      FETCHER, SHAPES_DB, grid_positions, cc.get_centre_row(),
+      cc.get_centre_col());
   {
     std::ofstream output(tile_path, std::ios::out | std::ios::binary);
-    tile.SerializeToOstream(&output);
+    combined->tile.SerializeToOstream(&output);
   }
 
   std::ofstream test_out(test_out_path, std::ios::out);
-  std::vector<EdgeToPenaltyMap> pen_mps = edge_to_penalty_maps(tile);
   for (Point &p : cell_points) {
-    translate_point_to_building_centre(p, tile, pen_mps);
+    translate_point_to_building_centre(p, combined->store, *combined->index);
     test_out << p.x << "," << p.y << std::endl;
   }
   std::cout << "test_translate_multiple_points(" << test_name << "): Done"
@@ -205,11 +207,12 @@ void test_get_combined_tile() {
   grid_positions.push_back({21302, 14613}); // above
   grid_positions.push_back({21303, 14614}); // right
   grid_positions.push_back({21302, 14614}); // right and above
-  Tile tile = get_combined_tile(CURL_HANDLE, grid_positions,
-                                /*centre_row=*/21303, /*centre_col=*/14613);
+  std::shared_ptr<const CombinedTile> combined =
+      get_combined_tile(FETCHER, SHAPES_DB, grid_positions,
+                        /*centre_row=*/21303, /*centre_col=*/14613);
   std::ofstream output(COMBINATION_TEST_TILE_PATH,
                        std::ios::trunc | std::ios::binary);
-  tile.SerializeToOstream(&output);
+  combined->tile.SerializeToOstream(&output);
   std::cout << "test_get_combined_tile(): Done" << std::endl;
 }
 
@@ -235,13 +238,13 @@ void test_get_enclosure_type() {
   shape.add_edges(0);
   shape.add_edges(0);
   shape.add_edges(0);
-  EdgeToPenaltyMap pen_mp = edge_to_penalty_map(shape);
-  if (get_enclosure_type({1, 1}, shape, pen_mp) != EnclosureType::INSIDE) {
+  ShapeStore store;
+  store.add_shape(shape);
+  if (get_enclosure_type({1, 1}, store, 0) != EnclosureType::INSIDE) {
     std::cout << "test_get_enclosure_type(0): FAILED" << std::endl;
-  } else if (get_enclosure_type({2, 2}, shape, pen_mp) != EnclosureType::EDGE) {
+  } else if (get_enclosure_type({2, 2}, store, 0) != EnclosureType::EDGE) {
     std::cout << "test_get_enclosure_type(1): FAILED" << std::endl;
-  } else if (get_enclosure_type({3, 3}, shape, pen_mp) !=
-             EnclosureType::OUTSIDE) {
+  } else if (get_enclosure_type({3, 3}, store, 0) != EnclosureType::OUTSIDE) {
     std::cout << "test_get_enclosure_type(2): FAILED" << std::endl;
   } else {
     std::cout << "test_get_enclosure_type(): PASSED" << std::endl;
@@ -280,48 +283,49 @@ void test_edge_skimming() {
   shape.add_edges(4);
   shape.add_edges(0);
   shape.add_edges(0);
-  EdgeToPenaltyMap pen_mp = edge_to_penalty_map(shape);
+  ShapeStore store;
+  store.add_shape(shape);
 
   bool passed = true;
   EnclosureType t;
-  t = get_enclosure_type({2, 1}, shape, pen_mp);
+  t = get_enclosure_type({2, 1}, store, 0);
   if (t != EnclosureType::INSIDE) {
     std::cout << "test_edge_skimming(0): FAILED" << std::endl;
     std::cout << t << std::endl;
     passed = false;
   }
-  t = get_enclosure_type({2, 2}, shape, pen_mp);
+  t = get_enclosure_type({2, 2}, store, 0);
   if (t != EnclosureType::EDGE) {
     std::cout << "test_edge_skimming(1): FAILED" << std::endl;
     passed = false;
   }
-  t = get_enclosure_type({2, 0}, shape, pen_mp);
+  t = get_enclosure_type({2, 0}, store, 0);
   if (t != EnclosureType::EDGE) {
     std::cout << "test_edge_skimming(2): FAILED" << std::endl;
     passed = false;
   }
-  t = get_enclosure_type({2, 3}, shape, pen_mp);
+  t = get_enclosure_type({2, 3}, store, 0);
   if (t != EnclosureType::EDGE) {
     std::cout << "test_edge_skimming(3): FAILED" << std::endl;
     passed = false;
   }
-  t = get_enclosure_type({2, 3}, shape, pen_mp);
+  t = get_enclosure_type({2, 3}, store, 0);
   if (t != EnclosureType::EDGE) {
     std::cout << "test_edge_skimming(4): FAILED" << std::endl;
     passed = false;
   }
-  t = get_enclosure_type({2, 5}, shape, pen_mp);
+  t = get_enclosure_type({2, 5}, store, 0);
   if (t != EnclosureType::OUTSIDE) {
     std::cout << "test_edge_skimming(5): FAILED" << std::endl;
     passed = false;
   }
-  t = get_enclosure_type({2, -1}, shape, pen_mp);
+  t = get_enclosure_type({2, -1}, store, 0);
   if (t != EnclosureType::OUTSIDE) {
     std::cout << "test_edge_skimming(6): FAILED" << std::endl;
     std::cout << t << std::endl;
     passed = false;
   }
-  t = get_enclosure_type({4, 3}, shape, pen_mp);
+  t = get_enclosure_type({4, 3}, store, 0);
   if (t != EnclosureType::OUTSIDE) {
     std::cout << "test_edge_skimming(7): FAILED" << std::endl;
     passed = false;
@@ -331,6 +335,264 @@ void test_edge_skimming() {
   }
 }
 
+void add_edge(BuildingShape &shape, int x1, int y1, int x2, int y2) {
+  shape.add_edges(x1);
+  shape.add_edges(y1);
+  shape.add_edges(x2);
+  shape.add_edges(y2);
+}
+
+/*
+ * A staircase with more edges than a SIMD register
+ * holds, so the vectorised ray casting is exercised
+ */
+void test_staircase_enclosure() {
+  const int nstep = 8;
+  BuildingShape shape;
+  add_edge(shape, 0, 0, nstep, 0);
+  for (int x = nstep; x != 0; x--) {
+    add_edge(shape, x, nstep - x, x, nstep - x + 1);
+    add_edge(shape, x, nstep - x + 1, x - 1, nstep - x + 1);
+  }
+  add_edge(shape, 0, nstep, 0, 0);
+  ShapeStore store;
+  store.add_shape(shape);
+
+  bool passed = true;
+  std::vector<std::pair<Point, EnclosureType>> cases = {
+      {{1, 1}, EnclosureType::INSIDE},  {{2, 3}, EnclosureType::INSIDE},
+      {{4, 4}, EnclosureType::EDGE},    {{3, 6}, EnclosureType::EDGE},
+      {{0, 5}, EnclosureType::EDGE},    {{6, 6}, EnclosureType::OUTSIDE},
+      {{9, 0}, EnclosureType::OUTSIDE}, {{4, -1}, EnclosureType::OUTSIDE}};
+  for (size_t i = 0; i != cases.size(); i++) {
+    if (get_enclosure_type(cases[i].first, store, 0) != cases[i].second) {
+      std::cout << "test_staircase_enclosure(" << i << "): FAILED"
+                << std::endl;
+      passed = false;
+    }
+  }
+  if (passed) {
+    std::cout << "test_staircase_enclosure(): PASSED" << std::endl;
+  }
+}
+
+void test_set_edge_penalties() {
+  BuildingShape shape;
+  shape.set_osid("osid");
+  add_edge(shape, 0, 0, 4, 0);
+  add_edge(shape, 4, 0, 4, 2);
+  add_edge(shape, 4, 2, 2, 2);
+  add_edge(shape, 2, 2, 2, 4);
+  add_edge(shape, 2, 4, 0, 4);
+  add_edge(shape, 0, 4, 0, 0);
+  set_edge_penalties(shape);
+  std::vector<int> penalties(shape.penalties().begin(),
+                             shape.penalties().end());
+  BuildingShape parsed;
+  parsed.ParseFromString(shape.SerializeAsString());
+  ShapeStore store;
+  store.add_shape(parsed);
+  if (penalties != std::vector<int>({0, 2, 0, 1, 0, 2})) {
+    std::cout << "test_set_edge_penalties(0): FAILED" << std::endl;
+  } else if (get_enclosure_type({2, 1}, store, 0) != EnclosureType::INSIDE ||
+             get_enclosure_type({2, 3}, store, 0) != EnclosureType::EDGE) {
+    std::cout << "test_set_edge_penalties(1): FAILED" << std::endl;
+  } else {
+    std::cout << "test_set_edge_penalties(): PASSED" << std::endl;
+  }
+}
+
+void add_square(Tile &tile, const std::string &osid, int x, int y,
+                int size) {
+  BuildingShape *shape = tile.add_shapes();
+  shape->set_osid(osid);
+  add_edge(*shape, x, y, x, y + size);
+  add_edge(*shape, x, y + size, x + size, y + size);
+  add_edge(*shape, x + size, y + size, x + size, y);
+  add_edge(*shape, x + size, y, x, y);
+  shape->add_approx_centre(x + size / 2);
+  shape->add_approx_centre(y + size / 2);
+}
+
+void test_set_interior_shapes() {
+  Tile tile;
+  add_square(tile, "interior", 10, 10, 10);
+  add_square(tile, "left_border", 0, 10, 10);
+  add_square(tile, "top_border", 10, 502, 10);
+  // two parts of the same building can't be copied alone
+  add_square(tile, "two_parts", 100, 100, 10);
+  add_square(tile, "two_parts", 110, 100, 10);
+  add_square(tile, "past_border", 505, 20, 10);
+  set_interior_shapes(tile);
+  std::vector<int> interior(tile.interior_shapes().begin(),
+                            tile.interior_shapes().end());
+  if (interior != std::vector<int>({0})) {
+    std::cout << "test_set_interior_shapes(): FAILED" << std::endl;
+  } else {
+    std::cout << "test_set_interior_shapes(): PASSED" << std::endl;
+  }
+}
+
+void test_shape_index() {
+  Tile tile;
+  // 0,0 -> 10,10 square
+  BuildingShape *shape = tile.add_shapes();
+  for (int e : {0, 0, 0, 10, 0, 10, 10, 10, 10, 10, 10, 0, 10, 0, 0, 0}) {
+    shape->add_edges(e);
+  }
+  // 5,5 -> 100,100 square overlapping the first
+  shape = tile.add_shapes();
+  for (int e : {5, 5, 5, 100, 5, 100, 100, 100, 100, 100, 100, 5, 100, 5, 5,
+                5}) {
+    shape->add_edges(e);
+  }
+  ShapeStore store(tile);
+  ShapeIndex index(store.bboxes);
+  std::vector<int> res;
+  bool passed = true;
+  index.query({1, 1}, res);
+  if (res != std::vector<int>({0})) {
+    std::cout << "test_shape_index(0): FAILED" << std::endl;
+    passed = false;
+  }
+  index.query({7, 7}, res);
+  if (res != std::vector<int>({0, 1})) {
+    std::cout << "test_shape_index(1): FAILED" << std::endl;
+    passed = false;
+  }
+  index.query({90, 90}, res);
+  if (res != std::vector<int>({1})) {
+    std::cout << "test_shape_index(2): FAILED" << std::endl;
+    passed = false;
+  }
+  index.query({101, 50}, res);
+  if (!res.empty()) {
+    std::cout << "test_shape_index(3): FAILED" << std::endl;
+    passed = false;
+  }
+  if (passed) {
+    std::cout << "test_shape_index(): PASSED" << std::endl;
+  }
+}
+
+void test_get_enclosing_shapes() {
+  Tile tile;
+  // 0,0 -> 10,10 square
+  BuildingShape *shape = tile.add_shapes();
+  for (int e : {0, 0, 0, 10, 0, 10, 10, 10, 10, 10, 10, 0, 10, 0, 0, 0}) {
+    shape->add_edges(e);
+  }
+  // 5,5 -> 100,100 square overlapping the first
+  shape = tile.add_shapes();
+  for (int e : {5, 5, 5, 100, 5, 100, 100, 100, 100, 100, 100, 5, 100, 5, 5,
+                5}) {
+    shape->add_edges(e);
+  }
+  ShapeStore store(tile);
+  ShapeIndex index(store.bboxes);
+  // 10,7 is on the edge of the first square so falls
+  // through to the second, 5,50 is on the second's edge
+  std::vector<Point> points = {{50, 50}, {1, 1},   {7, 7},
+                               {10, 7},  {101, 50}, {5, 50}};
+  std::vector<int> res;
+  get_enclosing_shapes(points, store, index, res);
+  if (res != std::vector<int>({1, 0, 0, 1, -1, -1})) {
+    std::cout << "test_get_enclosing_shapes(): FAILED" << std::endl;
+  } else {
+    std::cout << "test_get_enclosing_shapes(): PASSED" << std::endl;
+  }
+}
+
+/*
+ * A staircase with enough edges, and points, to be swept
+ * by get_enclosing_shapes, checked against the ray casting
+ * of each point. The grid of points covers every vertex
+ * and runs along every edge.
+ */
+void test_sweep_enclosing_shapes() {
+  const int nstep = 64;
+  Tile tile;
+  BuildingShape &shape = *tile.add_shapes();
+  add_edge(shape, 0, 0, nstep, 0);
+  for (int x = nstep; x != 0; x--) {
+    add_edge(shape, x, nstep - x, x, nstep - x + 1);
+    add_edge(shape, x, nstep - x + 1, x - 1, nstep - x + 1);
+  }
+  add_edge(shape, 0, nstep, 0, 0);
+  ShapeStore store(tile);
+  ShapeIndex index(store.bboxes);
+  std::vector<Point> points;
+  for (int y = -1; y <= nstep + 1; y++) {
+    for (int x = -1; x <= nstep + 1; x++) {
+      points.push_back({x, y});
+    }
+  }
+  std::vector<int> res;
+  get_enclosing_shapes(points, store, index, res);
+  int counts[3] = {0, 0, 0};
+  bool passed = true;
+  for (size_t i = 0; i != points.size(); i++) {
+    EnclosureType enc_type = get_enclosure_type(points[i], store, 0);
+    counts[static_cast<int>(enc_type)]++;
+    if ((res[i] == 0) != (enc_type == EnclosureType::INSIDE)) {
+      std::cout << "test_sweep_enclosing_shapes(" << points[i].x << ","
+                << points[i].y << "): FAILED" << std::endl;
+      passed = false;
+    }
+  }
+  // sure to have been swept and to cover every case
+  if (store.edge_count(0) < 128 || !counts[0] || !counts[1] || !counts[2]) {
+    std::cout << "test_sweep_enclosing_shapes(cover): FAILED" << std::endl;
+    passed = false;
+  }
+  if (passed) {
+    std::cout << "test_sweep_enclosing_shapes(): PASSED" << std::endl;
+  }
+}
+
+void test_tile_cache() {
+  TileCache cache(/*capacity=*/100, /*nshards=*/1);
+  std::shared_ptr<const Tile> tile = std::make_shared<const Tile>();
+  cache.put({0, 0}, tile, 40);
+  cache.put({0, 1}, tile, 40);
+  cache.get({0, 0}); // {0, 1} is now least recently used
+  cache.put({0, 2}, tile, 40);
+  TileCache::Stats stats = cache.stats();
+  if (stats.evictions != 1 || stats.entries != 2 || stats.bytes != 80) {
+    std::cout << "test_tile_cache(0): FAILED" << std::endl;
+  } else if (!cache.get({0, 0}) || cache.get({0, 1}) || !cache.get({0, 2})) {
+    std::cout << "test_tile_cache(1): FAILED" << std::endl;
+  } else {
+    std::cout << "test_tile_cache(): PASSED" << std::endl;
+  }
+}
+
+void test_combined_tile_cache() {
+  CombinedTileCache cache(/*capacity=*/100, /*nshards=*/2);
+  std::shared_ptr<CombinedTile> combined = std::make_shared<CombinedTile>();
+  combined->positions = {{0, 0}, {0, 1}};
+  std::string key = combined_tile_key(combined->positions, 0, 0);
+  cache.put(key, combined, 10);
+  cache.put(combined_tile_key({{5, 5}}, 5, 5), combined, 10);
+  bool passed = true;
+  // positions in any order make the same key
+  if (combined_tile_key({{0, 1}, {0, 0}}, 0, 0) != key ||
+      combined_tile_key(combined->positions, 0, 1) == key) {
+    std::cout << "test_combined_tile_cache(0): FAILED" << std::endl;
+    passed = false;
+  }
+  cache.erase_if([](const std::string &key, const CombinedTile &combined) {
+    return key.rfind("5,5:", 0) == 0;
+  });
+  if (!cache.get(key) || cache.stats().entries != 1) {
+    std::cout << "test_combined_tile_cache(1): FAILED" << std::endl;
+    passed = false;
+  }
+  if (passed) {
+    std::cout << "test_combined_tile_cache(): PASSED" << std::endl;
+  }
+}
+
 int main() {
   // building endpoint coordinates
   test_translate_multiple_points(BNG_TEST_INP_PATH, CLUSTERING_TEST_INP_PATH,
@@ -343,6 +605,14 @@ int main() {
   test_get_combined_tile();
   test_get_enclosure_type();
   test_edge_skimming();
+  test_staircase_enclosure();
+  test_set_edge_penalties();
+  test_set_interior_shapes();
+  test_shape_index();
+  test_get_enclosing_shapes();
+  test_sweep_enclosing_shapes();
+  test_tile_cache();
+  test_combined_tile_cache();
   // planning endpoint coordinates
   test_translate_multiple_points(PLANNING_BNG_PATH, PLANNING_TEST_INP_PATH,
                                  PLANNING_TEST_TILE_PATH,
@@ -9,19 +9,30 @@
 #include <unordered_map>
 
 static const std::string CONFIG_FILE = "config.txt";
-static std::unordered_map<std::string, std::string> CONFIG;
 
-int global_to_nat_grid(double lat, double lng, float &x, float &y) {
+NatGridTransform::NatGridTransform() : ctx(proj_context_create()) {
   // https://stackoverflow.com/questions/31426559/c-convert-lat-long-to-bng-with-proj-4
   // https://proj.org/en/stable/development/migration.html#code-example
-  PJ_COORD c, c_out;
-  PJ *P = proj_create_crs_to_crs(
-      PJ_DEFAULT_CTX, "+proj=longlat +datum=WGS84",
-      "+proj=tmerc +lat_0=49 +lon_0=-2 +k=0.9996012717 +x_0=400000 +y_0=-100000"
-      " +ellps=airy +datum=OSGB36 +units=m +no_defs",
-      NULL);
+  P = proj_create_crs_to_crs(ctx, "+proj=longlat +datum=WGS84",
+                             "+proj=tmerc +lat_0=49 +lon_0=-2 "
+                             "+k=0.9996012717 +x_0=400000 +y_0=-100000"
+                             " +ellps=airy +datum=OSGB36 +units=m +no_defs",
+                             NULL);
+}
+
+NatGridTransform::~NatGridTransform() {
+  if (P) {
+    proj_destroy(P);
+  }
+  proj_context_destroy(ctx);
+}
+
+int global_to_nat_grid(const NatGridTransform &transform, double lat,
+                       double lng, float &x, float &y) {
+  PJ *P = transform.get();
   if (P == 0)
     return 0;
+  PJ_COORD c, c_out;
   c.lpzt.z = 0.0;
   c.lpzt.t = HUGE_VAL;
   c.lpzt.lam = lng;
@@ -33,7 +44,29 @@ int global_to_nat_grid(double lat, double lng, float &x, float &y) {
   return 1;
 }
 
-void init_config() {
+int global_to_nat_grid(const NatGridTransform &transform,
+                       const std::vector<double> &lats,
+                       const std::vector<double> &lngs, std::vector<float> &xs,
+                       std::vector<float> &ys) {
+  PJ *P = transform.get();
+  if (P == 0)
+    return 0;
+  // transformed in place
+  std::vector<double> lams(lngs), phis(lats);
+  size_t n = lats.size();
+  proj_trans_generic(P, PJ_FWD, lams.data(), sizeof(double), n, phis.data(),
+                     sizeof(double), n, NULL, 0, 0, NULL, 0, 0);
+  xs.resize(n);
+  ys.resize(n);
+  for (int i = 0; i != n; i++) {
+    xs[i] = round(lams[i] * 100.0) / 100.0; // rounded to 2 d.p.
+    ys[i] = round(phis[i] * 100.0) / 100.0;
+  }
+  return 1;
+}
+
+std::unordered_map<std::string, std::string> read_config() {
+  std::unordered_map<std::string, std::string> confs;
   std::string::iterator eq_sign;
   std::string line, conf_key, conf_val;
   std::ifstream confs_f(CONFIG_FILE);
@@ -41,15 +74,29 @@ void init_config() {
     eq_sign = find(line.begin(), line.end(), '=');
     conf_key = std::string(line.begin(), eq_sign);
     conf_val = std::string(eq_sign + 1, line.end());
-    CONFIG[conf_key] = conf_val;
+    confs[conf_key] = conf_val;
   }
+  return confs;
 }
 
 std::string config(const std::string &key) {
-  if (CONFIG.empty()) {
-    init_config();
+  // Read once, then only ever looked up so
+  // worker threads can share it without locking
+  static const std::unordered_map<std::string, std::string> CONFIG =
+      read_config();
+  auto it = CONFIG.find(key);
+  if (it == CONFIG.end()) {
+    return "";
+  }
+  return it->second;
+}
+
+long config_long(const std::string &key, long fallback) {
+  std::string val = config(key);
+  if (val.empty()) {
+    return fallback;
   }
-  return CONFIG[key];
+  return atol(val.c_str());
 }
 
 size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
@@ -66,6 +113,246 @@ void make_get_request(CURL *handle, char *url, std::string &data) {
   curl_easy_perform(handle);
 }
 
+MultiFetcher::MultiFetcher()
+    : multi(curl_multi_init()),
+      connect_timeout(config_long("CONNECT_TIMEOUT_S", 10)),
+      timeout(config_long("REQUEST_TIMEOUT_S", 30)) {
+  // Connections per host are capped, any
+  // extra transfers wait in curl's queue
+  curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                    config_long("MAX_HOST_CONNECTIONS", 8));
+}
+
+MultiFetcher::~MultiFetcher() {
+  for (CURL *handle : handles) {
+    curl_easy_cleanup(handle);
+  }
+  curl_multi_cleanup(multi);
+}
+
+std::vector<bool> MultiFetcher::get(const std::vector<std::string> &urls,
+                                    std::vector<std::string> &data) {
+  std::vector<bool> ok(urls.size(), false);
+  data.assign(urls.size(), std::string());
+  while (handles.size() < urls.size()) {
+    CURL *handle = curl_easy_init();
+    if (handle == nullptr) {
+      std::cerr << "Failed to create easy curl handle" << std::endl;
+      break;
+    }
+    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, connect_timeout);
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT, timeout);
+    handles.push_back(handle);
+  }
+  // urls without a handle are left failed
+  size_t nurls = std::min(urls.size(), handles.size());
+  for (int i = 0; i != nurls; i++) {
+    curl_easy_setopt(handles[i], CURLOPT_URL, urls[i].c_str());
+    curl_easy_setopt(handles[i], CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(handles[i], CURLOPT_WRITEDATA, &data[i]);
+    curl_easy_setopt(handles[i], CURLOPT_HTTPGET, 1);
+    curl_multi_add_handle(multi, handles[i]);
+  }
+
+  int running = 0, nmsgs;
+  CURLMsg *msg;
+  do {
+    if (curl_multi_perform(multi, &running) != CURLM_OK) {
+      std::cerr << "Failed to perform multi curl requests" << std::endl;
+      break;
+    }
+    if (running) {
+      curl_multi_poll(multi, NULL, 0, 1000, NULL);
+    }
+  } while (running);
+  long status;
+  while ((msg = curl_multi_info_read(multi, &nmsgs))) {
+    if (msg->msg != CURLMSG_DONE) {
+      continue;
+    }
+    size_t i = std::find(handles.begin(), handles.begin() + nurls,
+                         msg->easy_handle) -
+               handles.begin();
+    if (i == nurls) {
+      continue;
+    }
+    if (msg->data.result != CURLE_OK) {
+      std::cerr << "Request failed: " << curl_easy_strerror(msg->data.result)
+                << std::endl;
+      continue;
+    }
+    curl_easy_getinfo(handles[i], CURLINFO_RESPONSE_CODE, &status);
+    ok[i] = status >= 200 && status < 300;
+    if (!ok[i]) {
+      std::cerr << "Request failed with status " << status << std::endl;
+    }
+  }
+
+  for (int i = 0; i != nurls; i++) {
+    curl_multi_remove_handle(multi, handles[i]);
+  }
+  return ok;
+}
+
+/*
+ * JsonFields code
+ */
+JsonFields::JsonFields(std::vector<const char *> names)
+    : names(std::move(names)), states(this->names.size(), MISSING),
+      strings(this->names.size()), numbers(this->names.size()) {}
+
+int JsonFields::find(const std::string &key) const {
+  for (int i = 0; i != names.size(); i++) {
+    if (key == names[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void JsonFields::clear() { std::fill(states.begin(), states.end(), MISSING); }
+
+std::string JsonFields::first_string(std::initializer_list<int> fields) const {
+  for (int field : fields) {
+    if (has(field)) {
+      return string(field);
+    }
+  }
+  return std::string();
+}
+
+/*
+ * JsonPageSax code
+ */
+bool JsonPageSax::parse(const std::string &page) {
+  depth = 0;
+  return nlohmann::json::sax_parse(page, this);
+}
+
+bool JsonPageSax::null() {
+  int field;
+  JsonFields *fields = current_field(field);
+  if (fields) {
+    fields->set_null(field);
+  }
+  return true;
+}
+
+bool JsonPageSax::number_integer(number_integer_t val) {
+  int field;
+  JsonFields *fields = current_field(field);
+  if (fields) {
+    fields->set(field, static_cast<double>(val));
+  }
+  return true;
+}
+
+bool JsonPageSax::number_unsigned(number_unsigned_t val) {
+  int field;
+  JsonFields *fields = current_field(field);
+  if (fields) {
+    fields->set(field, static_cast<double>(val));
+  }
+  return true;
+}
+
+bool JsonPageSax::number_float(number_float_t val, const string_t &s) {
+  int field;
+  JsonFields *fields = current_field(field);
+  if (fields) {
+    fields->set(field, val);
+  }
+  return true;
+}
+
+bool JsonPageSax::string(string_t &val) {
+  int field;
+  JsonFields *fields = current_field(field);
+  if (fields) {
+    fields->set(field, val);
+  }
+  return true;
+}
+
+bool JsonPageSax::start_object(std::size_t elements) {
+  object_started();
+  enter();
+  return true;
+}
+
+bool JsonPageSax::end_object() {
+  depth--;
+  object_ended();
+  return true;
+}
+
+bool JsonPageSax::start_array(std::size_t elements) {
+  enter();
+  return true;
+}
+
+bool JsonPageSax::end_array() {
+  depth--;
+  return true;
+}
+
+bool JsonPageSax::key(string_t &val) {
+  keys[depth - 1].assign(val);
+  return true;
+}
+
+bool JsonPageSax::parse_error(std::size_t position,
+                              const std::string &last_token,
+                              const nlohmann::detail::exception &ex) {
+  std::cerr << "Failed to parse page: " << ex.what() << std::endl;
+  return false;
+}
+
+bool JsonPageSax::at(std::initializer_list<const char *> path) const {
+  if (path.size() != depth) {
+    return false;
+  }
+  size_t i = 0;
+  for (const char *key : path) {
+    if (keys[i++] != key) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool JsonPageSax::inside(std::initializer_list<const char *> path) const {
+  if (path.size() + 1 != depth) {
+    return false;
+  }
+  size_t i = 0;
+  for (const char *key : path) {
+    if (keys[i++] != key) {
+      return false;
+    }
+  }
+  return true;
+}
+
+JsonFields *JsonPageSax::current_field(int &field) {
+  if (depth == 0) {
+    return nullptr;
+  }
+  JsonFields *fields = fields_here();
+  if (fields == nullptr) {
+    return nullptr;
+  }
+  field = fields->find(keys[depth - 1]);
+  return field == -1 ? nullptr : fields;
+}
+
+void JsonPageSax::enter() {
+  if (keys.size() == depth) {
+    keys.emplace_back();
+  }
+  keys[depth++].clear();
+}
+
 std::string longest_common_substr(const std::string &a, const std::string &b) {
   int m = a.size(), n = b.size();
   if (n == 0 || m == 0) {
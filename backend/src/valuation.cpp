@@ -44,27 +44,167 @@ std::string Valuation::to_string(int tablevel) const {
   return res;
 }
 
+void write_json(JsonWriter &writer, const LineItem &item) {
+  writer.start_object();
+  writer.field("area", item.area);
+  writer.field("description", item.description);
+  writer.field("floor", item.floor);
+  writer.field("value", item.value);
+  writer.end_object();
+}
+
+void write_json(JsonWriter &writer, const Parking &parking) {
+  writer.start_object();
+  writer.field("spaces", parking.spaces);
+  writer.field("value", parking.value);
+  writer.end_object();
+}
+
+void write_json(JsonWriter &writer, const Valuation &valuation) {
+  writer.start_object();
+  writer.field("building_name", valuation.building_name);
+  writer.field("is_composite", valuation.is_composite);
+  writer.field("line_items", valuation.line_items);
+  writer.key("parking");
+  write_json(writer, valuation.parking);
+  writer.field("plants_machinery_value", valuation.plants_machinery_value);
+  writer.field("primary_description", valuation.primary_description);
+  writer.field("rateable_value", valuation.rateable_value);
+  writer.field("secondary_description", valuation.secondary_description);
+  writer.end_object();
+}
+
 /*
  * ValuationDB code
  */
+
+/*
+ * A name matches any entry with it as one of its space
+ * separated words, ignoring ASCII case as LIKE does, so
+ * names of a single word are looked up by that word in
+ * list_entry_tokens. Null for names the LIKEs would
+ * treat differently, which are matched by scanning.
+ */
+static nlohmann::json name_token(const char *name) {
+  std::string token(name);
+  if (token.empty() || token.find_first_of(" %_") != std::string::npos) {
+    return nullptr;
+  }
+  for (char &c : token) {
+    if (c >= 'A' && c <= 'Z') {
+      c += 'a' - 'A';
+    }
+  }
+  return token;
+}
+
+// [[index, postcode, street, building name, token], ...] bound to ?
+static const std::string VALUATIONS_INPUTS_SQL =
+    "WITH inp AS ("
+    "  SELECT json_extract(value, '$[0]') idx, "
+    "  json_extract(value, '$[1]') postcode, "
+    "  json_extract(value, '$[2]') street, "
+    "  json_extract(value, '$[3]') building_name, "
+    "  json_extract(value, '$[4]') token "
+    "  FROM json_each(?)) ";
+
+// names that are a single token only need the
+// entries listing it, checked against the LIKEs
+static const std::string VALUATIONS_TOKEN_SQL =
+    "SELECT inp.idx, ca.assessment_reference, "
+    "ca.primary_description_text, ca.scat_description_text, "
+    "ca.composite_indicator, ca.rateable_value, ca.number_or_name, "
+    "ca.uarn "
+    "FROM inp "
+    "INNER JOIN list_entry_tokens lt "
+    "ON lt.postcode = inp.postcode AND lt.street = inp.street "
+    "AND lt.token = inp.token "
+    "INNER JOIN list_entries le "
+    "ON le.uarn = lt.uarn "
+    "AND le.postcode = inp.postcode AND le.street = inp.street AND ( "
+    "le.number_or_name = inp.building_name "
+    "OR le.number_or_name LIKE '% ' || inp.building_name "
+    "OR le.number_or_name LIKE inp.building_name || ' %' "
+    "OR le.number_or_name LIKE '% ' || inp.building_name || ' %' "
+    ") "
+    "INNER JOIN current_assessments ca "
+    "ON le.uarn = ca.uarn "
+    "WHERE inp.token IS NOT NULL ";
+
+static const std::string VALUATIONS_SCAN_SQL =
+    "SELECT inp.idx, ca.assessment_reference, "
+    "ca.primary_description_text, ca.scat_description_text, "
+    "ca.composite_indicator, ca.rateable_value, ca.number_or_name, "
+    "ca.uarn "
+    "FROM inp "
+    "INNER JOIN list_entries le "
+    "ON le.postcode = inp.postcode AND le.street = inp.street AND ( "
+    "le.number_or_name = inp.building_name "
+    "OR le.number_or_name LIKE '% ' || inp.building_name "
+    "OR le.number_or_name LIKE inp.building_name || ' %' "
+    "OR le.number_or_name LIKE '% ' || inp.building_name || ' %' "
+    ") "
+    "INNER JOIN current_assessments ca "
+    "ON le.uarn = ca.uarn "
+    "WHERE inp.token IS NULL ";
+
+bool ValuationDB::has_tokens() {
+  if (tokens_loaded) {
+    return true;
+  }
+  // doesn't compile if the table doesn't exist
+  stmt = statement(TOKENS_SELECT, "SELECT 1 FROM list_entry_tokens LIMIT 1;");
+  if (stmt != nullptr) {
+    tokens_loaded = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_reset(stmt);
+  }
+  if (!tokens_loaded && !tokens_warned) {
+    std::cerr << "list_entry_tokens hasn't been built, run "
+                 "list_entry_tokens.sql. Matching every name by scanning "
+                 "until then"
+              << std::endl;
+    tokens_warned = true;
+  }
+  return tokens_loaded;
+}
+
+bool ValuationDB::has_assessments() {
+  if (assessments_loaded) {
+    return true;
+  }
+  // doesn't compile if the table doesn't exist
+  stmt = statement(ASSESSMENTS_SELECT,
+                   "SELECT 1 FROM current_assessments LIMIT 1;");
+  if (stmt != nullptr) {
+    assessments_loaded = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_reset(stmt);
+  }
+  if (!assessments_loaded && !assessments_warned) {
+    std::cerr << "current_assessments hasn't been built, run "
+                 "current_assessments.sql. No valuations can be looked up "
+                 "until then"
+              << std::endl;
+    assessments_warned = true;
+  }
+  return assessments_loaded;
+}
+
 std::vector<ValuationDB::QueryResult>
 ValuationDB::get_valuations(std::vector<QueryParam> &params) {
   std::vector<QueryResult> results(params.size());
   PkToValuationMap pk_to_valuation;
-  for (int i = 0; i != params.size(); i++) {
-    if (!params[i].ignore) {
-      get_valuations(params[i], results[i], pk_to_valuation);
-    }
-  }
+  get_valuations(params, results, pk_to_valuation);
 
-  std::string pks_str;
+  // JSON array to bind for the IN lists
+  std::string pks_str = "[";
   int i = 0;
-  for (const std::pair<long, Valuation *> &p : pk_to_valuation) {
+  for (const auto &p : pk_to_valuation) {
     if (i++ > 0) {
       pks_str += ",";
     }
     pks_str += std::to_string(p.first);
   };
+  pks_str += "]";
 
   get_line_items(pks_str, pk_to_valuation);
   get_plants_machinery_value(pks_str, pk_to_valuation);
@@ -72,133 +212,151 @@ ValuationDB::get_valuations(std::vector<QueryParam> &params) {
   return results;
 }
 
-void ValuationDB::get_valuations(const QueryParam &param, QueryResult &result,
+void ValuationDB::get_valuations(const std::vector<QueryParam> &params,
+                                 std::vector<QueryResult> &results,
                                  PkToValuationMap &pk_to_valuation) {
-  long primary_key;
-  const char *primary_desc_col, *secondary_desc_col, *composite_col,
-      *building_name_col;
-  int query_sz = make_valuations_select(param);
-  sqlite3_prepare_v2(db, query_buff, query_sz, &stmt, NULL);
+  bool use_tokens = has_tokens();
+  // [[index, postcode, street, building name, token], ...]
+  nlohmann::json inputs = nlohmann::json::array();
+  for (int i = 0; i != params.size(); i++) {
+    if (!params[i].ignore) {
+      inputs.push_back(
+          {i, params[i].postcode, params[i].street, params[i].building_name,
+           use_tokens ? name_token(params[i].building_name) : nullptr});
+    }
+  }
+  if (inputs.empty()) {
+    return;
+  }
+  std::string inputs_str =
+      inputs.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+
+  if (use_tokens) {
+    static const std::string sql = VALUATIONS_INPUTS_SQL +
+                                   VALUATIONS_TOKEN_SQL + "UNION ALL " +
+                                   VALUATIONS_SCAN_SQL + "ORDER BY 1, 8; ";
+    stmt = statement(VALUATIONS_SELECT, sql.c_str());
+  } else {
+    // every token is null so only the scan is needed
+    static const std::string sql =
+        VALUATIONS_INPUTS_SQL + VALUATIONS_SCAN_SQL + "ORDER BY 1, 8; ";
+    stmt = statement(VALUATIONS_SCAN_SELECT, sql.c_str());
+  }
   if (stmt == nullptr) {
     std::cerr << "Failed to prepare valuations statement" << std::endl;
     return;
   }
+  sqlite3_bind_text(stmt, /*idx*/ 1, inputs_str.data(), inputs_str.size(),
+                    SQLITE_STATIC);
+
+  // (primary key, input index), the valuations
+  // can move until every row has been read
+  std::vector<std::pair<long, int>> pks;
+  int idx;
+  const char *primary_desc_col, *secondary_desc_col, *composite_col,
+      *building_name_col;
   while (sqlite3_step(stmt) == SQLITE_ROW) {
-    result.push_back({});
-    Valuation &valuation = result.back();
-    primary_key = sqlite3_column_int64(stmt, 0);
-    primary_desc_col = (const char *)sqlite3_column_text(stmt, 1);
-    secondary_desc_col = (const char *)sqlite3_column_text(stmt, 2);
-    composite_col = (const char *)sqlite3_column_text(stmt, 3);
-    building_name_col = (const char *)sqlite3_column_text(stmt, 5);
+    idx = sqlite3_column_int(stmt, 0);
+    results[idx].push_back({});
+    Valuation &valuation = results[idx].back();
+    primary_desc_col = (const char *)sqlite3_column_text(stmt, 2);
+    secondary_desc_col = (const char *)sqlite3_column_text(stmt, 3);
+    composite_col = (const char *)sqlite3_column_text(stmt, 4);
+    building_name_col = (const char *)sqlite3_column_text(stmt, 6);
 
     valuation.building_name = building_name_col;
     valuation.primary_description = primary_desc_col;
     valuation.secondary_description = secondary_desc_col;
     valuation.is_composite = strcmp(composite_col, "C") == 0;
-    valuation.rateable_value = sqlite3_column_int64(stmt, 4);
-    pk_to_valuation[primary_key] = &valuation;
+    valuation.rateable_value = sqlite3_column_int64(stmt, 5);
+    pks.push_back({sqlite3_column_int64(stmt, 1), idx});
   }
-  sqlite3_finalize(stmt);
-}
+  sqlite3_reset(stmt);
 
-int ValuationDB::make_valuations_select(const QueryParam &param) {
-  return snprintf(
-      query_buff, query_buff_sz,
-      "SELECT rle.assessment_reference, le.primary_description_text, "
-      "sc.description_text, "
-      "le.composite_indicator, le.rateable_value, le.number_or_name "
-      "FROM list_entries le "
-      "INNER JOIN related_list_entries rle "
-      "ON le.uarn = rle.uarn AND rle.from_date = ( "
-      "SELECT MAX(from_date) FROM related_list_entries WHERE uarn = le.uarn) "
-      "INNER JOIN scat_codes sc "
-      "ON le.scat_code_and_suffix = sc.scat_code_and_suffix "
-      "WHERE le.postcode = '%s' AND le.street = '%s' AND ( "
-      "le.number_or_name = '%s' OR le.number_or_name LIKE '%% %s'  "
-      "OR le.number_or_name LIKE '%s %%' OR le.number_or_name LIKE '%% %s "
-      "%%' "
-      "); ",
-      param.postcode, param.street, param.building_name, param.building_name,
-      param.building_name, param.building_name);
+  std::vector<int> filled(results.size(), 0);
+  for (const std::pair<long, int> &pk : pks) {
+    pk_to_valuation[pk.first].push_back(
+        &results[pk.second][filled[pk.second]++]);
+  }
 }
 
 void ValuationDB::get_line_items(const std::string &references,
                                  PkToValuationMap &ref_to_valuation) {
-  int query_sz = make_line_items_select(references);
-  sqlite3_prepare_v2(db, query_buff, query_sz, &stmt, NULL);
-  if (stmt == nullptr) {
-    std::cerr << "Failed to prepare line_items statement" << std::endl;
-    return;
-  }
-  while (sqlite3_step(stmt) == SQLITE_ROW) {
-    Valuation *valuation = ref_to_valuation[sqlite3_column_int64(stmt, 0)];
-    valuation->line_items.push_back({(const char *)sqlite3_column_text(stmt, 1),
-                                     (const char *)sqlite3_column_text(stmt, 2),
-                                     sqlite3_column_double(stmt, 3),
-                                     sqlite3_column_int64(stmt, 4)});
-  }
-  sqlite3_finalize(stmt);
-}
-
-int ValuationDB::make_line_items_select(const std::string &references) {
-  return snprintf(
-      query_buff, query_buff_sz,
+  stmt = statement(
+      LINE_ITEMS_SELECT,
       "SELECT assessment_reference, floor, description, area, value "
-      "FROM line_items WHERE assessment_reference IN (%s) "
+      "FROM line_items WHERE assessment_reference IN ( "
+      "SELECT value FROM json_each(?1)) "
       "UNION "
       "SELECT assessment_reference, 'Addtional' floor, oa_description "
       "description, "
       "oa_size area, oa_value value "
       "FROM additional_items "
-      "WHERE assessment_reference IN (%s); ",
-      references.c_str(), references.c_str());
+      "WHERE assessment_reference IN (SELECT value FROM json_each(?1)) "
+      "ORDER BY 1, 2, 3, 4, 5; ");
+  if (stmt == nullptr) {
+    std::cerr << "Failed to prepare line_items statement" << std::endl;
+    return;
+  }
+  sqlite3_bind_text(stmt, /*idx*/ 1, references.data(), references.size(),
+                    SQLITE_STATIC);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    LineItem item = {(const char *)sqlite3_column_text(stmt, 1),
+                     (const char *)sqlite3_column_text(stmt, 2),
+                     sqlite3_column_double(stmt, 3),
+                     sqlite3_column_int64(stmt, 4)};
+    for (Valuation *valuation :
+         ref_to_valuation[sqlite3_column_int64(stmt, 0)]) {
+      valuation->line_items.push_back(item);
+    }
+  }
+  sqlite3_reset(stmt);
 }
 
 void ValuationDB::get_plants_machinery_value(
     const std::string &references, PkToValuationMap &ref_to_valuation) {
-  int query_sz = make_plants_machinery_select(references);
-  sqlite3_prepare_v2(db, query_buff, query_sz, &stmt, NULL);
+  stmt = statement(PLANTS_MACHINERY_SELECT,
+                   "SELECT assessment_reference, pm_value "
+                   "FROM plant_and_machinery "
+                   "WHERE assessment_reference IN ( "
+                   "SELECT value FROM json_each(?)) "
+                   "ORDER BY rowid; ");
   if (stmt == nullptr) {
     std::cerr << "Failed to prepare plants_and_machinery statement"
               << std::endl;
     return;
   }
+  sqlite3_bind_text(stmt, /*idx*/ 1, references.data(), references.size(),
+                    SQLITE_STATIC);
   while (sqlite3_step(stmt) == SQLITE_ROW) {
-    Valuation &valuation = *ref_to_valuation[sqlite3_column_int64(stmt, 0)];
-    valuation.plants_machinery_value = sqlite3_column_int64(stmt, 1);
+    for (Valuation *valuation :
+         ref_to_valuation[sqlite3_column_int64(stmt, 0)]) {
+      valuation->plants_machinery_value = sqlite3_column_int64(stmt, 1);
+    }
   }
-  sqlite3_finalize(stmt);
-}
-
-int ValuationDB::make_plants_machinery_select(const std::string &references) {
-  return snprintf(query_buff, query_buff_sz,
-                  "SELECT assessment_reference, pm_value "
-                  "FROM plant_and_machinery "
-                  "WHERE assessment_reference IN (%s); ",
-                  references.c_str());
+  sqlite3_reset(stmt);
 }
 
 void ValuationDB::get_car_parking(const std::string &references,
                                   PkToValuationMap &ref_to_valuation) {
-  int query_sz = make_car_parks_select(references);
-  sqlite3_prepare_v2(db, query_buff, query_sz, &stmt, NULL);
+  stmt = statement(CAR_PARKS_SELECT,
+                   "SELECT assessment_reference, cp_spaces, cp_total "
+                   "FROM car_parks "
+                   "WHERE assessment_reference IN ( "
+                   "SELECT value FROM json_each(?)) "
+                   "ORDER BY rowid;");
   if (stmt == nullptr) {
     std::cerr << "Failed to prepare car_parks statement" << std::endl;
     return;
   }
+  sqlite3_bind_text(stmt, /*idx*/ 1, references.data(), references.size(),
+                    SQLITE_STATIC);
   while (sqlite3_step(stmt) == SQLITE_ROW) {
-    Valuation &valuation = *ref_to_valuation[sqlite3_column_int64(stmt, 0)];
-    valuation.parking.spaces = sqlite3_column_int(stmt, 1);
-    valuation.parking.value = sqlite3_column_int64(stmt, 2);
+    for (Valuation *valuation :
+         ref_to_valuation[sqlite3_column_int64(stmt, 0)]) {
+      valuation->parking.spaces = sqlite3_column_int(stmt, 1);
+      valuation->parking.value = sqlite3_column_int64(stmt, 2);
+    }
   }
-  sqlite3_finalize(stmt);
-}
-
-int ValuationDB::make_car_parks_select(const std::string &references) {
-  return snprintf(query_buff, query_buff_sz,
-                  "SELECT assessment_reference, cp_spaces, cp_total "
-                  "FROM car_parks "
-                  "WHERE assessment_reference IN (%s);",
-                  references.c_str());
+  sqlite3_reset(stmt);
 }
@@ -0,0 +1,325 @@
+#include "../include/valuation_snapshot.h"
+#include "../include/util.h"
+#include <cstring>
+#include <iostream>
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+
+/*
+ * Matching code
+ */
+static inline char fold_case(char c) {
+  return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+// Skips the UTF-8 character starting at `str`
+static inline const char *next_char(const char *str) {
+  str++;
+  while ((*str & 0xC0) == 0x80) {
+    str++;
+  }
+  return str;
+}
+
+/*
+ * SQLite's default LIKE: % matches any run of
+ * characters, _ any one character and ASCII
+ * letters match either case
+ */
+static bool like(const char *pattern, const char *str) {
+  // where to carry on from if the current
+  // attempt after the last % fails
+  const char *retry_pattern = nullptr, *retry_str = nullptr;
+  while (*str) {
+    if (*pattern == '%') {
+      retry_pattern = ++pattern;
+      retry_str = str;
+    } else if (*pattern == '_') {
+      pattern++;
+      str = next_char(str);
+    } else if (*pattern && fold_case(*pattern) == fold_case(*str)) {
+      pattern++;
+      str++;
+    } else if (retry_pattern) {
+      pattern = retry_pattern;
+      str = retry_str = next_char(retry_str);
+    } else {
+      return false;
+    }
+  }
+  while (*pattern == '%') {
+    pattern++;
+  }
+  return *pattern == '\0';
+}
+
+/*
+ * Same conditions as ValuationDB's valuations query,
+ * with the LIKE patterns made once per building name
+ */
+struct NameMatcher {
+  std::string name, ends_with, starts_with, contains;
+
+  NameMatcher(const char *building_name)
+      : name(building_name), ends_with("% " + name),
+        starts_with(name + " %"), contains("% " + name + " %") {}
+
+  bool matches(const std::string &number_or_name) const {
+    const char *str = number_or_name.c_str();
+    return number_or_name == name || like(ends_with.c_str(), str) ||
+           like(starts_with.c_str(), str) || like(contains.c_str(), str);
+  }
+};
+
+static std::string street_key(const char *postcode, const char *street) {
+  std::string res = postcode;
+  res += '\n';
+  res += street;
+  return res;
+}
+
+/*
+ * ValuationSnapshot code
+ */
+ValuationSnapshot::ValuationSnapshot() : loaded(false) {
+  sqlite3 *db;
+  if (sqlite3_open_v2(config("DB_PATH").c_str(), &db, SQLITE_OPEN_READONLY,
+                      NULL) != SQLITE_OK) {
+    std::cerr << "Couldn't open database for valuation snapshot" << std::endl;
+    sqlite3_close(db);
+    return;
+  }
+  // one read transaction so the tables are read as of the same import
+  sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+  loaded = load_entries(db) && load_line_items(db) &&
+           load_plants_machinery(db) && load_car_parks(db);
+  sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+  sqlite3_close(db);
+
+  // only needed while loading
+  std::unordered_map<std::string, StringId>().swap(string_ids);
+  std::unordered_map<long, uint32_t>().swap(reference_entries);
+}
+
+bool ValuationSnapshot::load_entries(sqlite3 *db) {
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db,
+                     "SELECT le.postcode, le.street, ca.assessment_reference, "
+                     "ca.number_or_name, ca.primary_description_text, "
+                     "ca.scat_description_text, ca.composite_indicator, "
+                     "ca.rateable_value "
+                     "FROM list_entries le "
+                     "INNER JOIN current_assessments ca "
+                     "ON le.uarn = ca.uarn "
+                     "WHERE le.postcode IS NOT NULL AND le.street IS NOT NULL "
+                     "AND ca.number_or_name IS NOT NULL "
+                     "ORDER BY le.postcode, le.street, le.uarn;",
+                     -1, &stmt, NULL);
+  if (stmt == nullptr) {
+    std::cerr << "Failed to prepare valuation snapshot entries select, "
+                 "has current_assessments.sql been run?"
+              << std::endl;
+    return false;
+  }
+  std::string key, prev_key;
+  uint32_t entry;
+  const char *composite;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    entry = names.size();
+    key = street_key((const char *)sqlite3_column_text(stmt, 0),
+                     (const char *)sqlite3_column_text(stmt, 1));
+    if (entry == 0 || key != prev_key) {
+      streets[key] = {entry, entry};
+      prev_key = key;
+    }
+    streets[key].second = entry + 1;
+    reference_entries[sqlite3_column_int64(stmt, 2)] = entry;
+
+    names.push_back(intern(sqlite3_column_text(stmt, 3)));
+    primary_descriptions.push_back(intern(sqlite3_column_text(stmt, 4)));
+    secondary_descriptions.push_back(intern(sqlite3_column_text(stmt, 5)));
+    composite = (const char *)sqlite3_column_text(stmt, 6);
+    composites.push_back(composite && strcmp(composite, "C") == 0);
+    rateable_values.push_back(sqlite3_column_int64(stmt, 7));
+  }
+  sqlite3_finalize(stmt);
+  if (names.empty()) {
+    std::cerr << "current_assessments hasn't been built, run "
+                 "current_assessments.sql"
+              << std::endl;
+    return false;
+  }
+  plants_machinery_values.assign(names.size(), 0);
+  parking_spaces.assign(names.size(), 0);
+  parking_values.assign(names.size(), 0);
+  return true;
+}
+
+bool ValuationSnapshot::load_line_items(sqlite3 *db) {
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db,
+                     "SELECT assessment_reference, floor, description, area, "
+                     "value "
+                     "FROM line_items "
+                     "UNION "
+                     "SELECT assessment_reference, 'Addtional' floor, "
+                     "oa_description description, oa_size area, "
+                     "oa_value value "
+                     "FROM additional_items "
+                     "ORDER BY 1, 2, 3, 4, 5;",
+                     -1, &stmt, NULL);
+  if (stmt == nullptr) {
+    std::cerr << "Failed to prepare valuation snapshot line items select"
+              << std::endl;
+    return false;
+  }
+  // (entry, row) of every line item belonging to
+  // an entry, counting sorted by entry once read
+  std::vector<std::pair<uint32_t, uint32_t>> entry_rows;
+  std::vector<StringId> floors, descriptions;
+  std::vector<double> areas;
+  std::vector<long> values;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    auto it = reference_entries.find(sqlite3_column_int64(stmt, 0));
+    if (it == reference_entries.end()) {
+      continue;
+    }
+    entry_rows.push_back({it->second, floors.size()});
+    floors.push_back(intern(sqlite3_column_text(stmt, 1)));
+    descriptions.push_back(intern(sqlite3_column_text(stmt, 2)));
+    areas.push_back(sqlite3_column_double(stmt, 3));
+    values.push_back(sqlite3_column_int64(stmt, 4));
+  }
+  sqlite3_finalize(stmt);
+
+  item_offsets.assign(names.size() + 1, 0);
+  for (const std::pair<uint32_t, uint32_t> &entry_row : entry_rows) {
+    item_offsets[entry_row.first + 1]++;
+  }
+  for (size_t i = 0; i != names.size(); i++) {
+    item_offsets[i + 1] += item_offsets[i];
+  }
+  std::vector<uint32_t> filled(item_offsets.begin(), item_offsets.end() - 1);
+  item_floors.resize(entry_rows.size());
+  item_descriptions.resize(entry_rows.size());
+  item_areas.resize(entry_rows.size());
+  item_values.resize(entry_rows.size());
+  for (const std::pair<uint32_t, uint32_t> &entry_row : entry_rows) {
+    uint32_t item = filled[entry_row.first]++;
+    item_floors[item] = floors[entry_row.second];
+    item_descriptions[item] = descriptions[entry_row.second];
+    item_areas[item] = areas[entry_row.second];
+    item_values[item] = values[entry_row.second];
+  }
+  return true;
+}
+
+bool ValuationSnapshot::load_plants_machinery(sqlite3 *db) {
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db,
+                     "SELECT assessment_reference, pm_value "
+                     "FROM plant_and_machinery "
+                     "ORDER BY rowid;",
+                     -1, &stmt, NULL);
+  if (stmt == nullptr) {
+    std::cerr << "Failed to prepare valuation snapshot plants_and_machinery "
+                 "select"
+              << std::endl;
+    return false;
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    auto it = reference_entries.find(sqlite3_column_int64(stmt, 0));
+    if (it != reference_entries.end()) {
+      plants_machinery_values[it->second] = sqlite3_column_int64(stmt, 1);
+    }
+  }
+  sqlite3_finalize(stmt);
+  return true;
+}
+
+bool ValuationSnapshot::load_car_parks(sqlite3 *db) {
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db,
+                     "SELECT assessment_reference, cp_spaces, cp_total "
+                     "FROM car_parks "
+                     "ORDER BY rowid;",
+                     -1, &stmt, NULL);
+  if (stmt == nullptr) {
+    std::cerr << "Failed to prepare valuation snapshot car_parks select"
+              << std::endl;
+    return false;
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    auto it = reference_entries.find(sqlite3_column_int64(stmt, 0));
+    if (it != reference_entries.end()) {
+      parking_spaces[it->second] = sqlite3_column_int(stmt, 1);
+      parking_values[it->second] = sqlite3_column_int64(stmt, 2);
+    }
+  }
+  sqlite3_finalize(stmt);
+  return true;
+}
+
+ValuationSnapshot::StringId
+ValuationSnapshot::intern(const unsigned char *str) {
+  std::string val = str ? (const char *)str : "";
+  auto it = string_ids.find(val);
+  if (it != string_ids.end()) {
+    return it->second;
+  }
+  StringId id = strings.size();
+  strings.push_back(val);
+  string_ids.emplace(std::move(val), id);
+  return id;
+}
+
+void ValuationSnapshot::add_valuation(uint32_t entry, QueryResult &res) const {
+  res.push_back({});
+  Valuation &valuation = res.back();
+  valuation.building_name = strings[names[entry]];
+  valuation.primary_description = strings[primary_descriptions[entry]];
+  valuation.secondary_description = strings[secondary_descriptions[entry]];
+  valuation.is_composite = composites[entry];
+  valuation.rateable_value = rateable_values[entry];
+  valuation.plants_machinery_value = plants_machinery_values[entry];
+  valuation.parking.spaces = parking_spaces[entry];
+  valuation.parking.value = parking_values[entry];
+  for (uint32_t i = item_offsets[entry]; i != item_offsets[entry + 1]; i++) {
+    valuation.line_items.push_back({strings[item_floors[i]],
+                                    strings[item_descriptions[i]],
+                                    item_areas[i], item_values[i]});
+  }
+}
+
+std::vector<ValuationEngine::QueryResult>
+ValuationSnapshot::get_valuations(std::vector<QueryParam> &params) {
+  std::vector<QueryResult> results(params.size());
+  for (int i = 0; i != params.size(); i++) {
+    if (params[i].ignore) {
+      continue;
+    }
+    auto it = streets.find(street_key(params[i].postcode, params[i].street));
+    if (it == streets.end()) {
+      continue;
+    }
+    NameMatcher matcher(params[i].building_name);
+    for (uint32_t entry = it->second.first; entry != it->second.second;
+         entry++) {
+      if (matcher.matches(strings[names[entry]])) {
+        add_valuation(entry, results[i]);
+      }
+    }
+  }
+  return results;
+}
+
+bool use_valuation_snapshot() {
+  static const bool use_snapshot = config("VALUATION_ENGINE") == "snapshot";
+  return use_snapshot;
+}
+
+ValuationSnapshot &valuation_snapshot() {
+  static ValuationSnapshot snapshot;
+  return snapshot;
+}
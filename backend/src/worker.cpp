@@ -0,0 +1,26 @@
+#include "../include/worker.h"
+#include "../include/httplib.h"
+#include "../include/util.h"
+#include <curl/curl.h>
+
+bool WorkerContext::ready() {
+  return places_fetcher.ready() && planit_fetcher.ready() &&
+         tiles_fetcher.ready() && nat_grid.ready();
+}
+
+ValuationEngine &WorkerContext::valuations() {
+  if (use_valuation_snapshot()) {
+    return valuation_snapshot();
+  }
+  return valuation_db;
+}
+
+WorkerContext &worker_context() {
+  thread_local WorkerContext ctx;
+  return ctx;
+}
+
+size_t worker_count() {
+  long workers = config_long("SERVER_WORKERS", CPPHTTPLIB_THREAD_POOL_COUNT);
+  return workers > 0 ? workers : 1;
+}